@@ -1,16 +1,37 @@
 #include <time.h>
+#include <math.h>
 #include <ctype.h>
 #include <netdb.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <stddef.h>
 #include <pthread.h>
 #include <stdbool.h>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <limits.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/tls.h>
+#include <linux/io_uring.h>
 #include <cjson/cJSON.h>
 #include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <nghttp2/nghttp2.h>
+#include <zlib.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "raylib.h"
 #define RAYGUI_IMPLEMENTATION
@@ -48,32 +69,54 @@ bool timer_done(Timer timer)
 typedef struct
 {
     size_t size;
+    size_t capacity;    // bytes 'data' can hold before it has to grow, there is always room for a null terminator after them
     char* data;
 } Buffer;
 
+#define MIN_BUFFER_CAPACITY 256
+
 Buffer init_buffer()
 {
     Buffer buffer;
     buffer.data = NULL;
     buffer.size = 0;
+    buffer.capacity = 0;
     return buffer;
 }
 
-void write_data_to_buffer(Buffer *buffer, const char* data, const size_t n)
+// makes room for at least n more bytes, the capacity doubles so that appending is amortized O(1)
+int reserve_buffer(Buffer *buffer, const size_t n)
 {
-    const size_t new_size = buffer->size + n + 1;
-    
-    char *new_data = realloc(buffer->data, new_size);
+    if (buffer->size + n <= buffer->capacity) {
+        return 0;
+    }
+
+    size_t new_capacity = (buffer->capacity < MIN_BUFFER_CAPACITY) ? MIN_BUFFER_CAPACITY : buffer->capacity * 2;
+    if (new_capacity < buffer->size + n) new_capacity = buffer->size + n;
+
+    char *new_data = realloc(buffer->data, new_capacity + 1);
     if (!new_data) {
-        printf("write_data_to_buffer: failed to reallocate %zu bytes\n", new_size);
-        return;
+        printf("reserve_buffer: failed to reallocate %zu bytes\n", new_capacity + 1);
+        return -1;
     }
 
     buffer->data = new_data;
+    buffer->capacity = new_capacity;
+    return 0;
+}
+
+void write_data_to_buffer(Buffer *buffer, const char* data, const size_t n)
+{
+    if (reserve_buffer(buffer, n) != 0) {
+        return;
+    }
+
     memcpy(&buffer->data[buffer->size], data, n);
     buffer->size += n;
+    buffer->data[buffer->size] = '\0';
 }
 
+// shrinking keeps the memory around for later growth
 int resize_buffer(Buffer *buffer, const size_t new_size)
 {
     if (!buffer) {
@@ -81,13 +124,13 @@ int resize_buffer(Buffer *buffer, const size_t new_size)
         return -1;
     }
 
-    char *new_data = realloc(buffer->data, new_size + 1);
-    if ((new_data == NULL) && (new_size > 0)) {
+    if ((new_size > buffer->size) && (reserve_buffer(buffer, new_size - buffer->size) != 0)) {
         printf("resize_buffer: failed to realloc %zu bytes\n", new_size);
         return -1;
     }
 
-    buffer->data = new_data;
+    if (!buffer->data) return 0;
+
     buffer->size = new_size;
     buffer->data[buffer->size] = '\0';
     return 0;
@@ -113,6 +156,7 @@ void free_buffer(Buffer *buffer)
     if (buffer->data) free(buffer->data);
     buffer->data = NULL;
     buffer->size = 0;
+    buffer->capacity = 0;
 }
 
 void create_file_from_memory(const char* filename, const Buffer buffer) 
@@ -126,6 +170,101 @@ void create_file_from_memory(const char* filename, const Buffer buffer)
     } 
 }
 
+Buffer load_file_into_memory(const char* filename)
+{
+    Buffer buffer = init_buffer();
+    FILE* fp = fopen(filename, "rb");
+    if (!fp) {
+        printf("could not read \"%s\" into memory\n", filename);
+        return buffer;
+    }
+
+    char chunk[65536];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+        write_data_to_buffer(&buffer, chunk, n);
+    }
+    fclose(fp);
+
+    return buffer;
+}
+
+#define MIN_ARENA_BLOCK (64 * 1024)
+
+typedef struct ArenaBlock
+{
+    struct ArenaBlock *next;
+    size_t capacity;
+    size_t used;
+    max_align_t data[];
+} ArenaBlock;
+
+// a bump allocator, nothing allocated from it is freed on its own, it all goes at once with the arena
+typedef struct
+{
+    ArenaBlock *blocks;     // newest first, each twice the size of the one before
+    size_t allocated;       // bytes asked for
+    size_t reserved;        // bytes of the blocks
+} Arena;
+
+Arena init_arena()
+{
+    return (Arena){0};
+}
+
+void* arena_alloc(Arena *arena, const size_t size)
+{
+    const size_t aligned = (size + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1);
+
+    ArenaBlock *block = arena->blocks;
+    if (!block || (block->capacity - block->used < aligned)) {
+        size_t capacity = block ? (2 * block->capacity) : MIN_ARENA_BLOCK;
+        while (capacity < aligned) capacity *= 2;
+
+        ArenaBlock *new_block = (ArenaBlock*) malloc(sizeof(ArenaBlock) + capacity);
+        if (!new_block) {
+            printf("arena_alloc: malloc returned NULL for a block of %zu bytes\n", capacity);
+            return NULL;
+        }
+        new_block->next = block;
+        new_block->capacity = capacity;
+        new_block->used = 0;
+        arena->blocks = block = new_block;
+        arena->reserved += capacity;
+    }
+
+    void *ptr = (char*) block->data + block->used;
+    block->used += aligned;
+    arena->allocated += size;
+    return ptr;
+}
+
+// the blocks double, so there are only a handful to free however many allocations were made
+void free_arena(Arena *arena)
+{
+    ArenaBlock *block = arena->blocks;
+    while (block) {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    *arena = init_arena();
+}
+
+// where cJSON allocates on this thread, the heap when NULL. threads that don't set one (thumbnails, the engine) are unaffected
+static __thread Arena *current_arena = NULL;
+
+void* cjson_alloc(size_t size)
+{
+    return current_arena ? arena_alloc(current_arena, size) : malloc(size);
+}
+
+// memory of the current arena is freed with it, a tree built outside of it must not be deleted while it is set
+void cjson_free(void *ptr)
+{
+    if (!current_arena) free(ptr);
+}
+
 // availible forms of content that youtube provides
 typedef enum
 {
@@ -322,12 +461,28 @@ typedef struct
     SortType sort;           
 } Query;
 
+// a search result that shows a thumbnail, several results can show the same image
+typedef struct ThumbnailWaiter
+{
+    char search_result_id[64];
+    struct ThumbnailWaiter *next;
+} ThumbnailWaiter;
+
+void free_thumbnail_waiters(ThumbnailWaiter *waiters)
+{
+    while (waiters) {
+        ThumbnailWaiter *to_free = waiters;
+        waiters = waiters->next;
+        free(to_free);
+    }
+}
+
 // holds raw thumbnail image data fetched from an HTTP request
 // intended for later conversion to a Texture (see LoadTextureFromMemory in raylib)
 typedef struct ThumbnailData
 {
     Buffer image_data;              
-    char search_result_id[256];     
+    ThumbnailWaiter *waiters;       // the image is decoded once and every waiter gets a texture of it
     struct ThumbnailData *next;
 } ThumbnailData;
 
@@ -335,6 +490,7 @@ void free_thumbnail_data(ThumbnailData *thumbnail_data)
 {
     if (!thumbnail_data) return;
     if (buffer_ready(&thumbnail_data->image_data)) free_buffer(&thumbnail_data->image_data);
+    free_thumbnail_waiters(thumbnail_data->waiters);
     free(thumbnail_data);
 }
 
@@ -364,393 +520,4883 @@ void enqueue_thumbnail(ThumbnailQueue *thumbnail_queue, ThumbnailData *thumbnail
         return;
     }
 
-    else if (!thumbnail_data) {
-        printf("enqueue_thumbnail: 'thumbnail_data' arg is NULL\n");
-        return;
+    else if (!thumbnail_data) {
+        printf("enqueue_thumbnail: 'thumbnail_data' arg is NULL\n");
+        return;
+    }
+
+    thumbnail_data->next = NULL;
+
+    if (thumbnail_queue->count == 0) 
+        thumbnail_queue->head = thumbnail_queue->tail = thumbnail_data;
+    else {
+        thumbnail_queue->tail->next = thumbnail_data;
+        thumbnail_queue->tail = thumbnail_data;
+    }
+
+    thumbnail_queue->count++;
+}
+
+ThumbnailData* dequeue_thumbnail(ThumbnailQueue *thumbnail_queue)
+{
+    if (!thumbnail_queue) {
+        printf("dequeue_thumbnail: 'thumbnail_queue' arg is NULL\n");
+        return NULL;
+    }
+
+    if (thumbnail_queue->count == 0) {
+        printf("dequeue_thumbnail: 'thumbnail_queue' arg is empty\n");
+        return NULL;
+    }
+
+    ThumbnailData *ret = thumbnail_queue->head;
+
+    thumbnail_queue->head = ret->next;
+    if (!thumbnail_queue->head) {
+        thumbnail_queue->tail = NULL;
+    }
+
+    thumbnail_queue->count--;
+
+    return ret;
+}
+
+void free_thumbnail_queue(ThumbnailQueue *thumbnail_queue)
+{
+    if (!thumbnail_queue) return;
+
+    while (thumbnail_queue->head) {
+        ThumbnailData *to_free = thumbnail_queue->head;
+        thumbnail_queue->head = thumbnail_queue->head->next;
+        free_thumbnail_data(to_free);
+    }
+
+    thumbnail_queue->count = 0;
+    thumbnail_queue->head = thumbnail_queue->tail = NULL;
+
+    pthread_mutex_destroy(&thumbnail_queue->mutex);
+}
+
+#define MINUTE 60
+#define CACHED_THUMBNAIL_LIFETIME (MINUTE * 3)
+
+// thumbnails stored seperatley and will be deleted when they expire (n seconds without use)
+// useful when preforming similar searches within a smaller time interval 
+
+void configure_youtube_search_query_path(const size_t n, char search_url[n], const Query query)
+{
+    // get the corresp. sorting param values 
+    const char *sort = sort_type_to_url(query.sort);
+    const char *media = media_type_to_url(query.media);
+
+    // configure the query path 
+    snprintf(search_url, n, "/results?search_query=%s&sp=%s%s", query.encoded_query, sort, media);
+}
+
+void configure_query_path(const size_t n, char search_url[n], const SortType sort, const MediaType media, const char *encoded_query)
+{
+    // get the corresp. sorting param values 
+    const char *sort_param = sort_type_to_url(sort);
+    const char *media_param = media_type_to_url(media);
+
+    // configure the query path 
+    snprintf(search_url, n, "/results?search_query=%s&sp=%s%s", encoded_query, sort_param, media_param);
+}
+
+// where a scan for the end of a json object stands, so that it can go on with the next slice of the object
+typedef struct
+{
+    int depth;
+    bool in_string;
+    bool escaped;       // the next byte is escaped by an odd run of backslashes
+} JsonScanState;
+
+// one byte at a time, for the tail of a scan and for targets without sse2
+size_t scan_json_bytes(JsonScanState *state, const char *data, const size_t n, const char opening, const char closing)
+{
+    for (size_t i = 0; i < n; i++) {
+        const char c = data[i];
+        if (state->escaped) state->escaped = false;
+        else if (c == '\\') state->escaped = true;
+        else if (c == '"') state->in_string = !state->in_string;
+        else if (state->in_string) continue;
+        else if (c == opening) state->depth++;
+        else if ((c == closing) && (--state->depth == 0)) return i;
+    }
+
+    return n;
+}
+
+#ifdef __SSE2__
+// bit i is set where byte i of the 64 equals c
+uint64_t match_json_bytes(const __m128i block[4], const char c)
+{
+    const __m128i needle = _mm_set1_epi8(c);
+    uint64_t mask = 0;
+    for (int i = 0; i < 4; i++) {
+        mask |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(block[i], needle)) << (16 * i);
+    }
+    return mask;
+}
+#endif
+
+// offset of the 'closing' byte that ends the object, n if it goes on past the data. 
+// 64 bytes at a time the quotes and backslashes become bit masks (like simdjson does it), a prefix xor of the unescaped quotes
+// marks the bytes inside strings, and only blocks in which the depth could reach 0 are looked at byte by byte
+size_t scan_json_structure(JsonScanState *state, const char *data, const size_t n, const char opening, const char closing)
+{
+    size_t offset = 0;
+
+#ifdef __SSE2__
+    const uint64_t even_bits = 0x5555555555555555ULL;
+    for ( ; offset + 64 <= n; offset += 64) {
+        __m128i block[4];
+        for (int i = 0; i < 4; i++) block[i] = _mm_loadu_si128((const __m128i*) &data[offset + 16 * i]);
+
+        // a run of backslashes escapes the byte after it if it is odd, runs that start at odd and even bits are told apart
+        // by adding their starts, which carries to the end of the run. a run may go on from the previous block
+        const uint64_t backslashes = match_json_bytes(block, '\\');
+        const uint64_t carried = state->escaped;
+        const uint64_t starts = backslashes & ~(backslashes << 1);
+        const uint64_t even_start_mask = even_bits ^ carried;
+        const uint64_t even_starts = starts & even_start_mask;
+        const uint64_t odd_starts = starts & ~even_start_mask;
+        const uint64_t even_carries = backslashes + even_starts;
+        uint64_t odd_carries;
+        state->escaped = __builtin_add_overflow(backslashes, odd_starts, &odd_carries);
+        odd_carries |= carried;
+        const uint64_t escaped = ((even_carries & ~backslashes) & ~even_bits) | ((odd_carries & ~backslashes) & even_bits);
+
+        // every unescaped quote flips whether the bytes after it are in a string
+        uint64_t in_string = match_json_bytes(block, '"') & ~escaped;
+        in_string ^= in_string << 1;
+        in_string ^= in_string << 2;
+        in_string ^= in_string << 4;
+        in_string ^= in_string << 8;
+        in_string ^= in_string << 16;
+        in_string ^= in_string << 32;
+        if (state->in_string) in_string = ~in_string;
+        state->in_string = in_string >> 63;
+
+        const uint64_t structural = ~in_string & ~escaped;
+        const uint64_t opens = match_json_bytes(block, opening) & structural;
+        const uint64_t closes = match_json_bytes(block, closing) & structural;
+
+        // with fewer closings than the depth, their order doesn't matter
+        const int close_count = __builtin_popcountll(closes);
+        if (close_count < state->depth) {
+            state->depth += __builtin_popcountll(opens) - close_count;
+            continue;
+        }
+
+        for (uint64_t remaining = opens | closes; remaining; remaining &= remaining - 1) {
+            const int bit = __builtin_ctzll(remaining);
+            if (opens & (1ULL << bit)) state->depth++;
+            else if (--state->depth == 0) return offset + bit;
+        }
+    }
+#endif
+
+    return offset + scan_json_bytes(state, &data[offset], n - offset, opening, closing);
+}
+
+// trims the fat (data not enclosed in object specified by tag) in place
+// compatible for both arrays ('[' and ']') and objects ('{' and '}'), brackets inside strings are ignored
+int parse_json_object(Buffer *buffer, const char *object, const char opening, const char closing)
+{
+    char *object_position = strstr(buffer->data, object);
+    char *start = object_position ? strchr(object_position, opening) : NULL;
+    if (start) {
+        const size_t remaining = buffer->size - (start - buffer->data);
+
+        JsonScanState state = {0};
+        const size_t end = scan_json_structure(&state, start, remaining, opening, closing);
+        if (end < remaining) {
+            // calculate the number of characters the object data contains
+            const size_t nchars = end + 1; 
+            
+            // shift the data to the front of the objects memory
+            memmove(buffer->data, start, nchars);
+            return resize_buffer(buffer, nchars);
+        }
+
+        else {
+            printf("parse_json_object: the opening %c and closing %c of the json object is unbalanced %d\n", opening, closing, state.depth);
+            return -1;
+        }
+    }
+
+    printf("parse_json_object: \"%s\" was not found\n", object);
+    return -1;
+}
+
+#define MAX_JSON_PATH_STEPS 16
+#define ANY_JSON_ELEMENT -1
+
+// one step down a json path, into a member of an object or an element of an array
+typedef struct
+{
+    const char *key;            // NULL for a step into an array
+    size_t key_len;
+    int index;                  // the element of the array, ANY_JSON_ELEMENT for each of them
+} JsonPathStep;
+
+typedef struct
+{
+    JsonPathStep steps[MAX_JSON_PATH_STEPS];
+    int nsteps;
+} JsonPath;
+
+// compiles a path like "title.runs[0].text" or "[1].contents[*]", the keys point into 'path'
+int compile_json_path(const char *path, JsonPath *compiled)
+{
+    compiled->nsteps = 0;
+    const char *c = path;
+    while (*c != '\0') {
+        if (compiled->nsteps == MAX_JSON_PATH_STEPS) {
+            printf("compile_json_path: \"%s\" has more than %d steps\n", path, MAX_JSON_PATH_STEPS);
+            return -1;
+        }
+
+        JsonPathStep *step = &compiled->steps[compiled->nsteps++];
+        if (*c == '[') {
+            char *end = (char*) c + 1;
+            step->key = NULL;
+            step->key_len = 0;
+            if (*end == '*') step->index = ANY_JSON_ELEMENT, end++;
+            else step->index = strtol(c + 1, &end, 10);
+
+            if ((*end != ']') || (step->index < ANY_JSON_ELEMENT)) {
+                printf("compile_json_path: bad index in \"%s\"\n", path);
+                return -1;
+            }
+            c = end + 1;
+        }
+
+        else {
+            step->key = c;
+            step->key_len = strcspn(c, ".[");
+            step->index = 0;
+            if (step->key_len == 0) {
+                printf("compile_json_path: empty key in \"%s\"\n", path);
+                return -1;
+            }
+            c += step->key_len;
+        }
+
+        if (*c == '.') c++;
+    }
+
+    return 0;
+}
+
+#define MAX_SCHEMA_PATHS 64
+
+// the paths of a static table, compiled. what a walk matched is told by the index into the table
+typedef struct
+{
+    JsonPath compiled[MAX_SCHEMA_PATHS];
+    int npaths;
+} JsonSchema;
+
+int compile_json_schema(JsonSchema *schema, const char *const paths[], const int npaths)
+{
+    schema->npaths = 0;
+    if (npaths > MAX_SCHEMA_PATHS) {
+        printf("compile_json_schema: %d paths, no more than %d fit\n", npaths, MAX_SCHEMA_PATHS);
+        return -1;
+    }
+
+    for (int i = 0; i < npaths; i++) {
+        if (compile_json_path(paths[i], &schema->compiled[i]) < 0) return -1;
+    }
+
+    schema->npaths = npaths;
+    return 0;
+}
+
+typedef struct
+{
+    const char *data;
+    size_t size;
+    size_t pos;
+} JsonCursor;
+
+// the next byte that isn't whitespace, '\0' once the data ran out
+char peek_json_char(JsonCursor *cursor)
+{
+    while ((cursor->pos < cursor->size) && isspace((unsigned char) cursor->data[cursor->pos])) cursor->pos++;
+    return (cursor->pos < cursor->size) ? cursor->data[cursor->pos] : '\0';
+}
+
+int read_json_hex(const char *digits, unsigned *code)
+{
+    *code = 0;
+    for (int i = 0; i < 4; i++) {
+        const char c = digits[i];
+        *code <<= 4;
+        if ((c >= '0') && (c <= '9')) *code |= c - '0';
+        else if ((c >= 'a') && (c <= 'f')) *code |= c - 'a' + 10;
+        else if ((c >= 'A') && (c <= 'F')) *code |= c - 'A' + 10;
+        else return -1;
+    }
+    return 0;
+}
+
+size_t encode_utf8(const unsigned code, char out[4])
+{
+    if (code < 0x80) {
+        out[0] = code;
+        return 1;
+    }
+    if (code < 0x800) {
+        out[0] = 0xC0 | (code >> 6);
+        out[1] = 0x80 | (code & 0x3F);
+        return 2;
+    }
+    if (code < 0x10000) {
+        out[0] = 0xE0 | (code >> 12);
+        out[1] = 0x80 | ((code >> 6) & 0x3F);
+        out[2] = 0x80 | (code & 0x3F);
+        return 3;
+    }
+    out[0] = 0xF0 | (code >> 18);
+    out[1] = 0x80 | ((code >> 12) & 0x3F);
+    out[2] = 0x80 | ((code >> 6) & 0x3F);
+    out[3] = 0x80 | (code & 0x3F);
+    return 4;
+}
+
+// reads the string at the cursor into 'out' with its escapes decoded (as cJSON does), cut to fit n bytes with the terminator.
+// without 'out' the string is only stepped over
+int read_json_string(JsonCursor *cursor, char *out, const size_t n)
+{
+    const char *data = cursor->data;
+    const size_t start = cursor->pos + 1;
+
+    // only the end matters, a quote is it unless an odd run of backslashes is in front of it
+    if (!out) {
+        const char *from = &data[start];
+        const char *quote;
+        while ((quote = memchr(from, '"', &data[cursor->size] - from))) {
+            size_t backslashes = 0;
+            while ((quote - backslashes > &data[start]) && (quote[-1 - (long) backslashes] == '\\')) backslashes++;
+            if (backslashes % 2 == 0) {
+                cursor->pos = quote - data + 1;
+                return 0;
+            }
+            from = quote + 1;
+        }
+    }
+
+    else {
+        size_t written = 0;
+        bool full = (n == 0);
+        for (size_t i = start; i < cursor->size; ) {
+            char decoded[4] = {data[i++]};
+            size_t len = 1;
+            if (decoded[0] == '"') {
+                if (n > 0) out[written] = '\0';
+                cursor->pos = i;
+                return 0;
+            }
+
+            if ((decoded[0] == '\\') && (i < cursor->size)) {
+                const char escape = data[i++];
+                unsigned code;
+                if (escape == 'b') decoded[0] = '\b';
+                else if (escape == 'f') decoded[0] = '\f';
+                else if (escape == 'n') decoded[0] = '\n';
+                else if (escape == 'r') decoded[0] = '\r';
+                else if (escape == 't') decoded[0] = '\t';
+                else if (escape != 'u') decoded[0] = escape;
+                else if ((i + 4 <= cursor->size) && (read_json_hex(&data[i], &code) == 0)) {
+                    i += 4;
+
+                    // characters past the basic plane come as a pair of surrogates, a lone one is dropped
+                    unsigned low;
+                    if ((code >= 0xD800) && (code < 0xDC00) && (i + 6 <= cursor->size) && (data[i] == '\\') && (data[i + 1] == 'u') &&
+                        (read_json_hex(&data[i + 2], &low) == 0) && (low >= 0xDC00) && (low < 0xE000)) {
+                        code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                        i += 6;
+                    }
+                    len = ((code >= 0xD800) && (code < 0xE000)) ? 0 : encode_utf8(code, decoded);
+                }
+                else len = 0;
+            }
+
+            // a character that doesn't fit in whole ends the copy
+            full = full || (written + len >= n);
+            if (!full) {
+                memcpy(&out[written], decoded, len);
+                written += len;
+            }
+        }
+    }
+
+    printf("read_json_string: the string at byte %zu has no end\n", cursor->pos);
+    return -1;
+}
+
+// steps over the value at the cursor, objects and arrays are skipped by their brackets without looking inside
+int skip_json_value(JsonCursor *cursor)
+{
+    const char c = peek_json_char(cursor);
+    if (c == '"') return read_json_string(cursor, NULL, 0);
+
+    if ((c == '{') || (c == '[')) {
+        JsonScanState state = {0};
+        const size_t remaining = cursor->size - cursor->pos;
+        const size_t end = scan_json_structure(&state, &cursor->data[cursor->pos], remaining, c, (c == '{') ? '}' : ']');
+        if (end == remaining) {
+            printf("skip_json_value: the %c at byte %zu is never closed\n", c, cursor->pos);
+            return -1;
+        }
+        cursor->pos += end + 1;
+        return 0;
+    }
+
+    // numbers, true, false and null
+    const size_t start = cursor->pos;
+    while ((cursor->pos < cursor->size) && !strchr(",:}] \t\r\n", cursor->data[cursor->pos])) cursor->pos++;
+    if (cursor->pos == start) {
+        printf("skip_json_value: no value at byte %zu\n", start);
+        return -1;
+    }
+    return 0;
+}
+
+// gets the value at the end of a path, with the cursor on it. a callback that moves the cursor took the value and 
+// has to have moved it past the value, otherwise the walk steps over it. returns < 0 to stop the walk
+typedef int (*JsonMatchCallback)(JsonCursor *cursor, const int path, void *user_data);
+
+typedef struct
+{
+    const JsonSchema *schema;
+    JsonMatchCallback on_match;
+    void *user_data;
+} JsonWalk;
+
+// 'candidates' has bit i set when the first 'depth' steps of path i lead to the value at the cursor
+int walk_json_value(const JsonWalk *walk, JsonCursor *cursor, const uint64_t candidates, const int depth)
+{
+    const JsonSchema *schema = walk->schema;
+
+    uint64_t deeper = 0;
+    for (int i = 0; i < schema->npaths; i++) {
+        if (!(candidates & (1ULL << i))) continue;
+        if (schema->compiled[i].nsteps > depth) {
+            deeper |= 1ULL << i;
+            continue;
+        }
+
+        peek_json_char(cursor);
+        const size_t at = cursor->pos;
+        if (walk->on_match(cursor, i, walk->user_data) < 0) return -1;
+        if (cursor->pos != at) return 0;
+    }
+
+    // nothing wanted below this value
+    const char opening = peek_json_char(cursor);
+    if (!deeper || ((opening != '{') && (opening != '['))) return skip_json_value(cursor);
+
+    const char closing = (opening == '{') ? '}' : ']';
+    cursor->pos++;
+    if (peek_json_char(cursor) == closing) {
+        cursor->pos++;
+        return 0;
+    }
+
+    for (int index = 0; ; index++) {
+        // the paths that go on into this member or element
+        uint64_t next = 0;
+        if (opening == '{') {
+            if (peek_json_char(cursor) != '"') break;
+            const char *key = &cursor->data[cursor->pos + 1];
+            if (read_json_string(cursor, NULL, 0) < 0) return -1;
+            const size_t key_len = &cursor->data[cursor->pos - 1] - key;
+            if (peek_json_char(cursor) != ':') break;
+            cursor->pos++;
+
+            for (int i = 0; i < schema->npaths; i++) {
+                const JsonPathStep *step = &schema->compiled[i].steps[depth];
+                if ((deeper & (1ULL << i)) && step->key && (step->key_len == key_len) && (memcmp(step->key, key, key_len) == 0)) next |= 1ULL << i;
+            }
+        }
+
+        else {
+            for (int i = 0; i < schema->npaths; i++) {
+                const JsonPathStep *step = &schema->compiled[i].steps[depth];
+                if ((deeper & (1ULL << i)) && !step->key && ((step->index == ANY_JSON_ELEMENT) || (step->index == index))) next |= 1ULL << i;
+            }
+        }
+
+        if ((next ? walk_json_value(walk, cursor, next, depth + 1) : skip_json_value(cursor)) < 0) return -1;
+
+        const char c = peek_json_char(cursor);
+        if ((c != ',') && (c != closing)) break;
+        cursor->pos++;
+        if (c == closing) return 0;
+    }
+
+    printf("walk_json_value: malformed json at byte %zu\n", cursor->pos);
+    return -1;
+}
+
+// pulls the values at the paths of the schema out of the json at the cursor in one pass, the rest is stepped over unparsed
+int walk_json(JsonCursor *cursor, const JsonSchema *schema, JsonMatchCallback on_match, void *user_data)
+{
+    const char opening = peek_json_char(cursor);
+    if ((opening != '{') && (opening != '[')) {
+        printf("walk_json: no json object or array at byte %zu\n", cursor->pos);
+        return -1;
+    }
+
+    const JsonWalk walk = {schema, on_match, user_data};
+    const uint64_t all_paths = (schema->npaths == 64) ? ~0ULL : ((1ULL << schema->npaths) - 1);
+    return walk_json_value(&walk, cursor, all_paths, 0);
+}
+
+#define MAX_EXTRACTED_KEY 64
+
+// finds the json object or array that follows 'key' in a body while it arrives, slice by slice, and keeps only its bytes
+typedef struct
+{
+    char key[MAX_EXTRACTED_KEY];
+    size_t key_len;
+    size_t fallback[MAX_EXTRACTED_KEY];    // how much of the key still matches after a mismatch, the key may span slices
+    size_t matched;
+    bool found;
+    char opening;       // '{' or '[', whichever comes first after the key
+    char closing;
+    JsonScanState scan;
+    bool done;
+} ObjectExtractor;
+
+void init_object_extractor(ObjectExtractor *extractor, const char *key)
+{
+    memset(extractor, 0, sizeof(*extractor));
+    snprintf(extractor->key, sizeof(extractor->key), "%s", key);
+    extractor->key_len = strlen(extractor->key);
+
+    // the longest proper prefix of key[0..i] that is also a suffix of it
+    for (size_t i = 1, k = 0; i < extractor->key_len; i++) {
+        while ((k > 0) && (extractor->key[i] != extractor->key[k])) k = extractor->fallback[k - 1];
+        if (extractor->key[i] == extractor->key[k]) k++;
+        extractor->fallback[i] = k;
+    }
+}
+
+// runs the bytes appended to the buffer at 'from' through the extractor, only those of the object stay, true once it closed
+bool extract_json_object(ObjectExtractor *extractor, Buffer *buffer, const size_t from)
+{
+    size_t kept = from;
+    for (size_t i = from; (i < buffer->size) && !extractor->done; i++) {
+        const char c = buffer->data[i];
+
+        if (!extractor->found) {
+            while ((extractor->matched > 0) && (c != extractor->key[extractor->matched])) extractor->matched = extractor->fallback[extractor->matched - 1];
+            if (c == extractor->key[extractor->matched]) extractor->matched++;
+            extractor->found = (extractor->matched == extractor->key_len);
+            continue;
+        }
+
+        if (extractor->scan.depth == 0) {
+            if ((c != '{') && (c != '[')) continue;
+            extractor->opening = c;
+            extractor->closing = (c == '{') ? '}' : ']';
+        }
+
+        // the rest of the slice belongs to the object, up to its end if that is in it
+        const size_t len = buffer->size - i;
+        const size_t end = scan_json_structure(&extractor->scan, &buffer->data[i], len, extractor->opening, extractor->closing);
+        const size_t object_len = (end < len) ? (end + 1) : len;
+        memmove(&buffer->data[kept], &buffer->data[i], object_len);
+        kept += object_len;
+        extractor->done = (end < len);
+        break;
+    }
+
+    buffer->size = kept;
+    if (buffer->data) buffer->data[kept] = '\0';
+    return extractor->done;
+}
+
+// work that becomes obsolete once the generation counter it was issued from moves on
+typedef struct
+{
+    const uint64_t *generation;     // NULL for work that is never cancelled
+    uint64_t issued;
+} CancelToken;
+
+// every search and the requests it starts share a token of this generation, a new search cancels them
+static uint64_t search_generation = 0;
+
+CancelToken current_search_token()
+{
+    return (CancelToken) { &search_generation, __atomic_load_n(&search_generation, __ATOMIC_ACQUIRE) };
+}
+
+// cancels every token issued so far from 'generation'
+void cancel_generation(uint64_t *generation)
+{
+    __atomic_add_fetch(generation, 1, __ATOMIC_ACQ_REL);
+}
+
+bool token_cancelled(const CancelToken token)
+{
+    return token.generation && (__atomic_load_n(token.generation, __ATOMIC_ACQUIRE) != token.issued);
+}
+
+#define DEFAULT_REQUEST_TIMEOUT 15 // seconds
+
+// when the phases of a request ended, in seconds of get_monotonic_time, 0 for those it skipped
+// (a request on an open connection or an http/2 stream neither resolves, connects nor handshakes)
+typedef struct
+{
+    double submitted;
+    double started;         // left the waiting list
+    double resolved;
+    double connected;
+    double handshaken;
+    double first_byte;      // of the response header
+    double finished;
+    size_t bytes_sent;
+    size_t bytes_received;  // header and body as delivered, after decompression
+} RequestTimings;
+
+typedef struct
+{
+    char *port;
+    char *host;
+    char path[256];
+    char body[1024];
+    char header[1024];
+    bool allow_http2;       // the request may be multiplexed over an http/2 connection if the host supports it
+    bool warm_up;           // nothing is sent, the connection is only established and left ready for later requests
+    bool allow_pipelining;  // the request may be written behind others on an http/1.1 connection, its response then waits for theirs
+    bool limited;           // runs under the adaptive concurrency limit of its host, so that bulk requests can't crowd out the rest
+    bool cacheable;         // a GET whose response may be kept and revalidated (see ResponseCache)
+    double timeout;         // seconds the request may take from submission, DEFAULT_REQUEST_TIMEOUT if 0
+    CancelToken cancel;     // the request is dropped as soon as the token is cancelled
+    RequestTimings *timings; // filled in right before the callback runs, if set
+    const char *extract_object; // only the json object (or array) after this key is kept from the body, handed over as soon as it closes
+} HTTP_Request;
+
+// states of the incremental http/1.1 response parser
+typedef enum
+{
+    PARSING_STATUS_LINE,
+    PARSING_HEADERS,
+    PARSING_BODY,               // body delimited by content-length
+    PARSING_BODY_UNTIL_CLOSE,   // body ends when the server closes the connection
+    PARSING_CHUNK_SIZE,
+    PARSING_CHUNK_DATA,
+    PARSING_CHUNK_END,          // the CRLF that follows the data of every chunk
+    PARSING_TRAILERS,
+    PARSING_DONE,
+    PARSING_FAILED,
+} HTTP_ParseState;
+
+// what the parser found in the bytes it was given
+typedef enum
+{
+    HTTP_NEED_MORE,         // every usable byte was consumed, more data has to be read
+    HTTP_HEADERS_READY,     // the status line and header fields are complete
+    HTTP_BODY_DATA,         // a slice of the (de-chunked) body
+    HTTP_MESSAGE_DONE,      // the response ended, nothing more belongs to it
+    HTTP_ERROR,
+} HTTP_Event;
+
+typedef struct
+{
+    HTTP_ParseState state;
+    int status_code;
+    bool keep_alive;            // the connection can carry another request after this response
+    bool chunked;
+    bool has_content_length;
+    size_t content_length;
+    size_t remaining;           // bytes left in the body or in the current chunk
+    size_t header_len;
+    char header[8192];          // status line and header fields as received, truncated if larger
+} HTTP_Response;
+
+void init_http_response(HTTP_Response *response)
+{
+    response->state = PARSING_STATUS_LINE;
+    response->status_code = 0;
+    response->keep_alive = true;
+    response->chunked = false;
+    response->has_content_length = false;
+    response->content_length = 0;
+    response->remaining = 0;
+    response->header_len = 0;
+    response->header[0] = '\0';
+}
+
+// case insensitive lookup of a header field, copies its value (without surrounding whitespace) into 'value'
+bool http_header_value(const char *header, const char *name, const size_t n, char value[n])
+{
+    const size_t name_len = strlen(name);
+
+    // the first line is the status line
+    const char *line = strstr(header, "\r\n");
+    while (line && (line[2] != '\0')) {
+        line += 2;
+        const char *end = strstr(line, "\r\n");
+        if (!end) end = line + strlen(line);
+
+        if ((strncasecmp(line, name, name_len) == 0) && (line[name_len] == ':')) {
+            const char *start = line + name_len + 1;
+            while ((start < end) && isspace((unsigned char)*start)) start++;
+
+            size_t len = end - start;
+            while ((len > 0) && isspace((unsigned char)start[len - 1])) len--;
+            if (len >= n) len = n - 1;
+
+            memcpy(value, start, len);
+            value[len] = '\0';
+            return true;
+        }
+
+        line = (*end == '\0') ? NULL : end;
+    }
+
+    return false;
+}
+
+// true if the comma seperated value of a header field contains 'token'
+bool http_header_has_token(const char *header, const char *name, const char *token)
+{
+    char value[256];
+    if (!http_header_value(header, name, sizeof(value), value)) {
+        return false;
+    }
+
+    const size_t token_len = strlen(token);
+    for (char *current = value; *current; current++) {
+        if ((strncasecmp(current, token, token_len) == 0) && ((current == value) || (current[-1] == ',') || isspace((unsigned char)current[-1]))) {
+            const char next = current[token_len];
+            if ((next == '\0') || (next == ',') || (next == ';') || isspace((unsigned char)next)) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+void append_response_header_line(HTTP_Response *response, const char *line, const size_t len)
+{
+    // keep room for the CRLF and null terminator
+    if ((response->header_len + len + 3) > sizeof(response->header)) {
+        return;
+    }
+
+    memcpy(&response->header[response->header_len], line, len);
+    response->header_len += len;
+    memcpy(&response->header[response->header_len], "\r\n", 3);
+    response->header_len += 2;
+}
+
+// decides how the body is framed once every header field has been seen
+void begin_response_body(HTTP_Response *response)
+{
+    char value[32];
+
+    if (http_header_has_token(response->header, "Connection", "close")) 
+        response->keep_alive = false;
+    else if (http_header_has_token(response->header, "Connection", "keep-alive"))
+        response->keep_alive = true;
+    
+    response->chunked = http_header_has_token(response->header, "Transfer-Encoding", "chunked");
+    response->has_content_length = http_header_value(response->header, "Content-Length", sizeof(value), value);
+    if (response->has_content_length) {
+        response->content_length = strtoull(value, NULL, 10);
+    }
+
+    // these never carry a body, whatever their header says
+    if ((response->status_code == 204) || (response->status_code == 304)) 
+        response->state = PARSING_DONE;
+
+    else if (response->chunked) 
+        response->state = PARSING_CHUNK_SIZE;
+
+    else if (response->has_content_length) {
+        response->remaining = response->content_length;
+        response->state = (response->remaining > 0) ? PARSING_BODY : PARSING_DONE;
+    }
+
+    else {
+        response->keep_alive = false;
+        response->state = PARSING_BODY_UNTIL_CLOSE;
+    }
+}
+
+// handles one complete line (without its CRLF) of the status line, header, chunk size or trailer section
+void parse_http_response_line(HTTP_Response *response, const char *line, const size_t len, bool *headers_ready)
+{
+    switch (response->state) {
+        case PARSING_STATUS_LINE: {
+            // "HTTP/1.1 200 OK"
+            if ((len < 12) || (strncmp(line, "HTTP/1.", 7) != 0)) {
+                printf("parse_http_response: malformed status line\n");
+                response->state = PARSING_FAILED;
+                return;
+            }
+
+            response->status_code = atoi(&line[9]);
+            response->keep_alive = (line[7] == '1');
+            append_response_header_line(response, line, len);
+            response->state = PARSING_HEADERS;
+            break;
+        }
+
+        case PARSING_HEADERS:
+            if (len > 0) {
+                append_response_header_line(response, line, len);
+                break;
+            }
+
+            // an interim response (100 continue) is followed by the real one
+            if ((response->status_code >= 100) && (response->status_code < 200)) {
+                init_http_response(response);
+                break;
+            }
+
+            begin_response_body(response);
+            *headers_ready = true;
+            break;
+
+        case PARSING_CHUNK_SIZE: {
+            char *end;
+            char hex[32];
+            const size_t hex_len = (len < sizeof(hex)) ? len : (sizeof(hex) - 1);
+            memcpy(hex, line, hex_len);
+            hex[hex_len] = '\0';
+            
+            response->remaining = strtoull(hex, &end, 16);
+            if ((end == hex) || ((*end != '\0') && (*end != ';') && !isspace((unsigned char)*end))) {
+                printf("parse_http_response: malformed chunk size \"%s\"\n", hex);
+                response->state = PARSING_FAILED;
+                return;
+            }
+
+            response->state = (response->remaining > 0) ? PARSING_CHUNK_DATA : PARSING_TRAILERS;
+            break;
+        }
+
+        case PARSING_CHUNK_END:
+            if (len != 0) {
+                printf("parse_http_response: chunk is not followed by CRLF\n");
+                response->state = PARSING_FAILED;
+                return;
+            }
+            response->state = PARSING_CHUNK_SIZE;
+            break;
+
+        case PARSING_TRAILERS:
+            // the message ends on an empty line
+            if (len == 0) response->state = PARSING_DONE;
+            break;
+
+        default:
+            break;
+    }
+}
+
+// consumes bytes from data and returns the first event they produce, 'consumed' is always set
+// body data is returned as a slice of 'data' through 'body' and 'body_len', valid as long as 'data' is
+HTTP_Event parse_http_response(HTTP_Response *response, const char *data, const size_t n, size_t *consumed, const char **body, size_t *body_len)
+{
+    size_t pos = 0;
+    *body = NULL;
+    *body_len = 0;
+
+    while (true) {
+        switch (response->state) {
+            case PARSING_STATUS_LINE:
+            case PARSING_HEADERS:
+            case PARSING_CHUNK_SIZE:
+            case PARSING_CHUNK_END:
+            case PARSING_TRAILERS: {
+                const char *line = data + pos;
+                const char *newline = memchr(line, '\n', n - pos);
+                if (!newline) {
+                    *consumed = pos;
+                    return HTTP_NEED_MORE;
+                }
+
+                pos += (newline - line) + 1;
+
+                size_t len = newline - line;
+                if ((len > 0) && (line[len - 1] == '\r')) len--;
+
+                bool headers_ready = false;
+                parse_http_response_line(response, line, len, &headers_ready);
+                if (headers_ready) {
+                    *consumed = pos;
+                    return HTTP_HEADERS_READY;
+                }
+                break;
+            }
+
+            case PARSING_BODY:
+            case PARSING_CHUNK_DATA: 
+            case PARSING_BODY_UNTIL_CLOSE: {
+                if (pos == n) {
+                    *consumed = pos;
+                    return HTTP_NEED_MORE;
+                }
+
+                size_t len = n - pos;
+                if ((response->state != PARSING_BODY_UNTIL_CLOSE) && (len > response->remaining)) {
+                    len = response->remaining;
+                }
+
+                *body = data + pos;
+                *body_len = len;
+                pos += len;
+
+                if (response->state != PARSING_BODY_UNTIL_CLOSE) {
+                    response->remaining -= len;
+                    if (response->remaining == 0) {
+                        response->state = (response->state == PARSING_BODY) ? PARSING_DONE : PARSING_CHUNK_END;
+                    }
+                }
+
+                *consumed = pos;
+                return HTTP_BODY_DATA;
+            }
+
+            case PARSING_DONE:
+                *consumed = pos;
+                return HTTP_MESSAGE_DONE;
+
+            case PARSING_FAILED:
+            default:
+                *consumed = pos;
+                return HTTP_ERROR;
+        }
+    }
+}
+
+SSL_CTX *ctx = NULL;
+
+// when true, openssl hands the record encryption of connections to the kernel where the cipher allows it,
+// plain bodies are then received with recvmsg straight into the response (see recv_kernel_tls)
+static bool kernel_tls = false;
+
+// wall clock seconds that are safe to read from any thread (unlike raylib's GetTime)
+double get_monotonic_time()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+#define MAX_DNS_ADDRESSES 8
+#define DNS_CACHE_TTL 300           // seconds, getaddrinfo doesn't expose the record's ttl
+#define DNS_FAILURE_TTL 5           // seconds a failed lookup is remembered before it is tried again
+
+// candidate addresses for a connection, in the order they should be tried
+typedef struct
+{
+    struct sockaddr_storage addresses[MAX_DNS_ADDRESSES];
+    socklen_t address_lens[MAX_DNS_ADDRESSES];
+    size_t count;
+} AddressList;
+
+// the addresses a host resolved to, in the order getaddrinfo preferred them except that the address
+// that won the last connection race is moved to the front and addresses that failed to connect to the back
+typedef struct DnsEntry
+{
+    char host[256];
+    char port[8];
+    struct sockaddr_storage addresses[MAX_DNS_ADDRESSES];
+    socklen_t address_lens[MAX_DNS_ADDRESSES];
+    size_t count;
+    int preferred_family;       // family of the address the last raced connection was won by, AF_UNSPEC if none was yet
+    double expires_at;
+    bool resolving;             // queued for or being resolved by the resolver thread
+    struct DnsEntry *next;
+} DnsEntry;
+
+typedef enum
+{
+    DNS_HIT,
+    DNS_PENDING,                // resolution was started, look the host up again once the resolver signals
+    DNS_FAILED,
+} DnsResult;
+
+// thread-safe cache of resolved hosts, misses are resolved by a dedicated thread 
+// so that a slow getaddrinfo never blocks the caller
+typedef struct
+{
+    DnsEntry *entries;
+    size_t hits;
+    size_t misses;
+    bool running;
+    int notify_fd;              // eventfd written to whenever a resolution finishes
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;        // signaled when an entry needs resolving or the resolver should stop
+} DnsCache;
+
+static DnsCache dns_cache;
+
+DnsCache init_dns_cache()
+{
+    DnsCache cache;
+    cache.entries = NULL;
+    cache.hits = cache.misses = 0;
+    cache.running = false;
+    cache.notify_fd = -1;
+    pthread_mutex_init(&cache.mutex, NULL);
+    pthread_cond_init(&cache.cond, NULL);
+    return cache;
+}
+
+// expects cache->mutex to be locked
+DnsEntry* find_dns_entry(DnsCache *cache, const char *host, const char *port)
+{
+    for (DnsEntry *current = cache->entries; current; current = current->next) {
+        if ((strcmp(current->host, host) == 0) && (strcmp(current->port, port) == 0)) {
+            return current;
+        }
+    }
+
+    DnsEntry *entry = malloc(sizeof(DnsEntry));
+    if (!entry) {
+        printf("find_dns_entry: malloc returned NULL for entry\n");
+        return NULL;
+    }
+
+    snprintf(entry->host, sizeof(entry->host), "%s", host);
+    snprintf(entry->port, sizeof(entry->port), "%s", port);
+    entry->count = 0;
+    entry->preferred_family = AF_UNSPEC;
+    entry->expires_at = 0;
+    entry->resolving = false;
+    entry->next = cache->entries;
+    cache->entries = entry;
+
+    return entry;
+}
+
+// orders the addresses of an entry for connection racing (RFC 8305), 
+// addresses of the preferred family lead and the two families alternate after that
+void order_dns_addresses(const DnsEntry *entry, AddressList *list)
+{
+    int first_family = entry->preferred_family;
+    if (first_family == AF_UNSPEC) first_family = entry->addresses[0].ss_family;
+
+    size_t firsts[MAX_DNS_ADDRESSES], first_count = 0;
+    size_t others[MAX_DNS_ADDRESSES], other_count = 0;
+    for (size_t i = 0; i < entry->count; i++) {
+        if (entry->addresses[i].ss_family == first_family) firsts[first_count++] = i;
+        else others[other_count++] = i;
+    }
+
+    list->count = 0;
+    for (size_t i = 0; (i < first_count) || (i < other_count); i++) {
+        if (i < first_count) {
+            list->addresses[list->count] = entry->addresses[firsts[i]];
+            list->address_lens[list->count++] = entry->address_lens[firsts[i]];
+        }
+        if (i < other_count) {
+            list->addresses[list->count] = entry->addresses[others[i]];
+            list->address_lens[list->count++] = entry->address_lens[others[i]];
+        }
+    }
+}
+
+// fills 'addresses' with the addresses of host in the order they should be connected to on a hit, 
+// an expired entry is still used while it is refreshed in the background
+DnsResult lookup_dns(DnsCache *cache, const char *host, const char *port, AddressList *addresses)
+{
+    DnsResult result;
+
+    pthread_mutex_lock(&cache->mutex);
+        DnsEntry *entry = find_dns_entry(cache, host, port);
+        const bool expired = entry && (get_monotonic_time() >= entry->expires_at);
+        
+        if (!entry || !cache->running) {
+            result = (entry && entry->count > 0) ? DNS_HIT : DNS_FAILED;
+        }
+        else if (entry->count > 0) {
+            result = DNS_HIT;
+        }
+        else if (!expired) {
+            result = DNS_FAILED;    // failed recently
+        }
+        else {
+            result = DNS_PENDING;
+        }
+
+        if (result == DNS_HIT) {
+            order_dns_addresses(entry, addresses);
+            cache->hits++;
+        }
+
+        // lookups that join a resolution already in progress aren't counted again
+        if (entry && expired && !entry->resolving && cache->running) {
+            if (result == DNS_PENDING) cache->misses++;
+            entry->resolving = true;
+            pthread_cond_signal(&cache->cond);
+        }
+    pthread_mutex_unlock(&cache->mutex);
+
+    return result;
+}
+
+// connecting to 'address' failed, later connections to host try it last
+void report_dns_failure(DnsCache *cache, const char *host, const char *port, const struct sockaddr_storage *address, const socklen_t address_len)
+{
+    pthread_mutex_lock(&cache->mutex);
+        DnsEntry *entry = find_dns_entry(cache, host, port);
+        for (size_t i = 0; entry && (i < entry->count); i++) {
+            if ((entry->address_lens[i] == address_len) && (memcmp(&entry->addresses[i], address, address_len) == 0)) {
+                const struct sockaddr_storage failed = entry->addresses[i];
+                memmove(&entry->addresses[i], &entry->addresses[i + 1], (entry->count - i - 1) * sizeof(entry->addresses[0]));
+                memmove(&entry->address_lens[i], &entry->address_lens[i + 1], (entry->count - i - 1) * sizeof(entry->address_lens[0]));
+                entry->addresses[entry->count - 1] = failed;
+                entry->address_lens[entry->count - 1] = address_len;
+                break;
+            }
+        }
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+// a raced connection to host was won by 'address', later races start with it and its family
+void report_dns_success(DnsCache *cache, const char *host, const char *port, const struct sockaddr_storage *address, const socklen_t address_len)
+{
+    pthread_mutex_lock(&cache->mutex);
+        DnsEntry *entry = find_dns_entry(cache, host, port);
+        for (size_t i = 0; entry && (i < entry->count); i++) {
+            if ((entry->address_lens[i] == address_len) && (memcmp(&entry->addresses[i], address, address_len) == 0)) {
+                memmove(&entry->addresses[1], &entry->addresses[0], i * sizeof(entry->addresses[0]));
+                memmove(&entry->address_lens[1], &entry->address_lens[0], i * sizeof(entry->address_lens[0]));
+                entry->addresses[0] = *address;
+                entry->address_lens[0] = address_len;
+                entry->preferred_family = address->ss_family;
+                break;
+            }
+        }
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+void* dns_resolver_thread(void *args)
+{
+    DnsCache *cache = (DnsCache*) args;
+
+    pthread_mutex_lock(&cache->mutex);
+    while (cache->running) {
+        DnsEntry *entry = cache->entries;
+        while (entry && !entry->resolving) {
+            entry = entry->next;
+        }
+
+        if (!entry) {
+            pthread_cond_wait(&cache->cond, &cache->mutex);
+            continue;
+        }
+
+        // entries are never freed while the resolver runs, host and port can be read unlocked
+        pthread_mutex_unlock(&cache->mutex);
+            struct addrinfo hints = {0};
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            
+            struct addrinfo *addresses = NULL;
+            const int status = getaddrinfo(entry->host, entry->port, &hints, &addresses);
+            if (status != 0) {
+                printf("dns_resolver_thread: getaddrinfo failed for %s (%s)\n", entry->host, gai_strerror(status));
+            }
+        pthread_mutex_lock(&cache->mutex);
+
+        // a failed refresh keeps the addresses that are already known
+        size_t count = 0;
+        for (struct addrinfo *current = addresses; current && (count < MAX_DNS_ADDRESSES); current = current->ai_next) {
+            if (current->ai_addrlen > sizeof(struct sockaddr_storage)) continue;
+            memcpy(&entry->addresses[count], current->ai_addr, current->ai_addrlen);
+            entry->address_lens[count] = current->ai_addrlen;
+            count++;
+        }
+
+        if (count > 0) {
+            entry->count = count;
+        }
+
+        entry->expires_at = get_monotonic_time() + ((count > 0) ? DNS_CACHE_TTL : DNS_FAILURE_TTL);
+        entry->resolving = false;
+        if (addresses) freeaddrinfo(addresses);
+
+        const uint64_t one = 1;
+        if ((cache->notify_fd >= 0) && (write(cache->notify_fd, &one, sizeof(one)) < 0)) {
+            printf("dns_resolver_thread: could not write to notify_fd\n");
+        }
+    }
+    pthread_mutex_unlock(&cache->mutex);
+
+    return NULL;
+}
+
+// 'notify_fd' is an eventfd that is written to after every resolution
+int start_dns_resolver(DnsCache *cache, const int notify_fd)
+{
+    cache->notify_fd = notify_fd;
+    cache->running = true;
+    if (pthread_create(&cache->thread, NULL, dns_resolver_thread, cache) != 0) {
+        printf("start_dns_resolver: pthread_create failed\n");
+        cache->running = false;
+        return -1;
+    }
+
+    return 0;
+}
+
+// waits for a lookup in progress to finish
+void stop_dns_resolver(DnsCache *cache)
+{
+    pthread_mutex_lock(&cache->mutex);
+        const bool was_running = cache->running;
+        cache->running = false;
+        pthread_cond_broadcast(&cache->cond);
+    pthread_mutex_unlock(&cache->mutex);
+
+    if (was_running) pthread_join(cache->thread, NULL);
+    cache->notify_fd = -1;
+}
+
+void print_dns_cache_stats(DnsCache *cache)
+{
+    pthread_mutex_lock(&cache->mutex);
+        const size_t total = cache->hits + cache->misses;
+        printf("dns lookups: %zu hits, %zu misses (%.1f%% hits)\n", 
+                cache->hits, cache->misses, total ? (100.0 * cache->hits / total) : 0.0);
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+void free_dns_cache(DnsCache *cache)
+{
+    stop_dns_resolver(cache);
+
+    while (cache->entries) {
+        DnsEntry *to_free = cache->entries;
+        cache->entries = to_free->next;
+        free(to_free);
+    }
+
+    pthread_cond_destroy(&cache->cond);
+    pthread_mutex_destroy(&cache->mutex);
+}
+
+// the most recent tls session of every host we've talked to, lets new connections resume 
+// a session with an abbreviated handshake instead of preforming a full one
+typedef struct TlsSession
+{
+    char host[256];
+    SSL_SESSION *session;
+    struct TlsSession *next;
+} TlsSession;
+
+typedef struct
+{
+    TlsSession *head;
+    size_t resumed_handshakes;
+    size_t full_handshakes;
+    size_t kernel_tls_handshakes;   // handshakes after which the kernel decrypts received records
+    pthread_mutex_t mutex;
+} TlsSessionCache;
+
+static TlsSessionCache tls_session_cache;
+
+TlsSessionCache init_tls_session_cache()
+{
+    TlsSessionCache cache;
+    cache.head = NULL;
+    cache.resumed_handshakes = cache.full_handshakes = cache.kernel_tls_handshakes = 0;
+    pthread_mutex_init(&cache.mutex, NULL);
+    return cache;
+}
+
+// takes ownership of the session, replacing the one previously stored for host
+void store_tls_session(TlsSessionCache *cache, const char *host, SSL_SESSION *session)
+{
+    pthread_mutex_lock(&cache->mutex);
+        TlsSession *current = cache->head;
+        while (current && (strcmp(current->host, host) != 0)) {
+            current = current->next;
+        }
+
+        if (!current) {
+            current = malloc(sizeof(TlsSession));
+            if (current) {
+                snprintf(current->host, sizeof(current->host), "%s", host);
+                current->session = NULL;
+                current->next = cache->head;
+                cache->head = current;
+            }
+        }
+
+        if (current) {
+            if (current->session) SSL_SESSION_free(current->session);
+            current->session = session;
+        }
+        else {
+            printf("store_tls_session: malloc returned NULL for tls session\n");
+            SSL_SESSION_free(session);
+        }
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+// returns a new reference to a resumable session for host, or NULL if there is none
+SSL_SESSION* find_tls_session(TlsSessionCache *cache, const char *host)
+{
+    SSL_SESSION *session = NULL;
+
+    pthread_mutex_lock(&cache->mutex);
+        for (TlsSession *current = cache->head; current; current = current->next) {
+            if (strcmp(current->host, host) == 0) {
+                if (current->session && SSL_SESSION_is_resumable(current->session)) {
+                    session = current->session;
+                    SSL_SESSION_up_ref(session);
+                }
+                break;
+            }
+        }
+    pthread_mutex_unlock(&cache->mutex);
+
+    return session;
+}
+
+void count_tls_handshake(TlsSessionCache *cache, const bool resumed, const bool kernel_tls)
+{
+    pthread_mutex_lock(&cache->mutex);
+        if (resumed) cache->resumed_handshakes++;
+        else cache->full_handshakes++;
+        if (kernel_tls) cache->kernel_tls_handshakes++;
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+void print_tls_session_stats(TlsSessionCache *cache)
+{
+    pthread_mutex_lock(&cache->mutex);
+        const size_t total = cache->resumed_handshakes + cache->full_handshakes;
+        printf("tls handshakes: %zu resumed, %zu full (%.1f%% resumed)\n", 
+                cache->resumed_handshakes, cache->full_handshakes, total ? (100.0 * cache->resumed_handshakes / total) : 0.0);
+        if (kernel_tls) printf("kernel tls: %zu of %zu connections\n", cache->kernel_tls_handshakes, total);
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+void free_tls_session_cache(TlsSessionCache *cache)
+{
+    while (cache->head) {
+        TlsSession *to_free = cache->head;
+        cache->head = to_free->next;
+        if (to_free->session) SSL_SESSION_free(to_free->session);
+        free(to_free);
+    }
+
+    pthread_mutex_destroy(&cache->mutex);
+}
+
+// called by openssl whenever the server issues a session (tls 1.3 sends these after the handshake)
+int on_new_tls_session(SSL *ssl, SSL_SESSION *session)
+{
+    const char *host = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+    if (!host) return 0;
+
+    store_tls_session(&tls_session_cache, host, session);
+    return 1; // we now own the session
+}
+
+SSL_CTX* create_ssl_ctx()
+{
+    SSL_CTX *ssl_ctx = SSL_CTX_new(TLS_client_method());
+    if (!ssl_ctx) {
+        printf("create_ssl_ctx: SSL_CTX_new failed\n");
+        return NULL;
+    }
+
+    // sessions are kept in 'tls_session_cache', keyed by host, rather than openssl's internal store
+    SSL_CTX_set_session_cache_mode(ssl_ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ssl_ctx, on_new_tls_session);
+
+    // http/2 is offered by default, connections for requests that need http/1.1 override this (see open_connection)
+    static const unsigned char alpn_protocols[] = "\x02h2\x08http/1.1";
+    if (SSL_CTX_set_alpn_protos(ssl_ctx, alpn_protocols, sizeof(alpn_protocols) - 1) != 0) {
+        printf("create_ssl_ctx: SSL_CTX_set_alpn_protos failed\n");
+    }
+
+    // output is written from a buffer that may move while a write is retried
+    SSL_CTX_set_mode(ssl_ctx, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+    // openssl only offloads ciphers the kernel supports, other connections stay in user space
+    if (kernel_tls) SSL_CTX_set_options(ssl_ctx, SSL_OP_ENABLE_KTLS);
+    
+    return ssl_ctx;
+}
+
+#define URING_ENTRIES 256
+#define URING_BUFFER_SLOTS 64       // connections that get registered buffers, the others use heap buffers
+#define URING_BUFFER_SIZE 16384
+
+// the user data of an operation is the address of its connection, the low bits tell which operation it was
+#define URING_CONNECT 1
+#define URING_RECEIVE 2
+#define URING_SEND 3
+#define URING_OPERATION_MASK 3
+
+// operations that don't belong to a connection
+#define URING_WAKE 0                // the read of the engine's wake_fd
+#define URING_CANCEL 1              // a cancellation of another operation
+
+// when true, the engine submits the connects, sends and receives of its connections to an io_uring
+// instead of waiting for readiness with epoll, selected at startup (see init_http_engine)
+static bool io_uring_backend = false;
+
+// an io_uring set up with raw system calls, with buffers registered with the kernel 
+// so that it doesn't map the pages of every send and receive on its own
+typedef struct
+{
+    int fd;
+    void *sq_ring;
+    void *cq_ring;
+    size_t sq_ring_size;
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned sq_entries;
+    unsigned sq_pending_tail;   // entries up to here are handed to the kernel with the next io_uring_enter
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    size_t in_flight;           // submitted operations whose completion hasn't been seen yet
+    char *buffers;              // an input and an output buffer per slot, NULL if they couldn't be registered
+    int free_slots[URING_BUFFER_SLOTS];
+    size_t free_slot_count;
+} IoUring;
+
+// only touched by the engine thread
+static IoUring uring = { .fd = -1 };
+
+int init_io_uring(IoUring *ring)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring->fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if (ring->fd < 0) {
+        printf("init_io_uring: io_uring_setup failed (%s)\n", strerror(errno));
+        return -1;
+    }
+
+    // waiting for completions with a timeout needs IORING_ENTER_EXT_ARG
+    if (!(params.features & IORING_FEAT_EXT_ARG)) {
+        printf("init_io_uring: the kernel doesn't support waiting with a timeout\n");
+        close(ring->fd);
+        ring->fd = -1;
+        return -1;
+    }
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_size > ring->sq_ring_size) ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_ring = (params.features & IORING_FEAT_SINGLE_MMAP) ? ring->sq_ring : 
+                    mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if ((ring->sq_ring == MAP_FAILED) || (ring->cq_ring == MAP_FAILED) || (ring->sqes == MAP_FAILED)) {
+        printf("init_io_uring: mmap failed\n");
+        if (ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqes_size);
+        if ((ring->cq_ring != MAP_FAILED) && (ring->cq_ring != ring->sq_ring)) munmap(ring->cq_ring, ring->cq_ring_size);
+        if (ring->sq_ring != MAP_FAILED) munmap(ring->sq_ring, ring->sq_ring_size);
+        close(ring->fd);
+        ring->fd = -1;
+        return -1;
+    }
+
+    ring->sq_head = (unsigned*) ((char*) ring->sq_ring + params.sq_off.head);
+    ring->sq_tail = (unsigned*) ((char*) ring->sq_ring + params.sq_off.tail);
+    ring->sq_mask = (unsigned*) ((char*) ring->sq_ring + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*) ((char*) ring->sq_ring + params.sq_off.array);
+    ring->sq_entries = params.sq_entries;
+    ring->sq_pending_tail = *ring->sq_tail;
+    ring->cq_head = (unsigned*) ((char*) ring->cq_ring + params.cq_off.head);
+    ring->cq_tail = (unsigned*) ((char*) ring->cq_ring + params.cq_off.tail);
+    ring->cq_mask = (unsigned*) ((char*) ring->cq_ring + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*) ((char*) ring->cq_ring + params.cq_off.cqes);
+    ring->in_flight = 0;
+
+    // without registered buffers every connection gets heap buffers, which works the same but slower
+    ring->free_slot_count = 0;
+    ring->buffers = aligned_alloc(4096, URING_BUFFER_SLOTS * 2 * URING_BUFFER_SIZE);
+    if (ring->buffers) {
+        struct iovec iovecs[URING_BUFFER_SLOTS * 2];
+        for (size_t i = 0; i < URING_BUFFER_SLOTS * 2; i++) {
+            iovecs[i].iov_base = &ring->buffers[i * URING_BUFFER_SIZE];
+            iovecs[i].iov_len = URING_BUFFER_SIZE;
+        }
+
+        if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, iovecs, URING_BUFFER_SLOTS * 2) != 0) {
+            printf("init_io_uring: registering buffers failed (%s)\n", strerror(errno));
+            free(ring->buffers);
+            ring->buffers = NULL;
+        }
+    }
+
+    if (ring->buffers) {
+        for (int i = URING_BUFFER_SLOTS - 1; i >= 0; i--) ring->free_slots[ring->free_slot_count++] = i;
+    }
+
+    return 0;
+}
+
+// operations still in flight are cancelled by the kernel
+void free_io_uring(IoUring *ring)
+{
+    if (ring->fd < 0) return;
+
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring != ring->sq_ring) munmap(ring->cq_ring, ring->cq_ring_size);
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+    ring->fd = -1;
+
+    free(ring->buffers);
+    ring->buffers = NULL;
+}
+
+// hands the queued entries to the kernel, then waits up to 'timeout_ms' (-1 for no limit) for a completion unless one is there already
+int enter_io_uring(IoUring *ring, const int timeout_ms)
+{
+    __atomic_store_n(ring->sq_tail, ring->sq_pending_tail, __ATOMIC_RELEASE);
+    const unsigned to_submit = ring->sq_pending_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    const bool wait = (timeout_ms != 0) && (__atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE) == *ring->cq_head);
+    if ((to_submit == 0) && !wait) return 0;
+
+    struct __kernel_timespec timeout = { .tv_sec = timeout_ms / 1000, .tv_nsec = (timeout_ms % 1000) * 1000000L };
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = (uint64_t) (uintptr_t) &timeout;
+
+    const bool limited = wait && (timeout_ms > 0);
+    const unsigned flags = (wait ? IORING_ENTER_GETEVENTS : 0) | (limited ? IORING_ENTER_EXT_ARG : 0);
+    if ((syscall(__NR_io_uring_enter, ring->fd, to_submit, wait ? 1 : 0, flags, limited ? &arg : NULL, limited ? sizeof(arg) : 0) < 0) 
+        && (errno != EINTR) && (errno != ETIME) && (errno != EBUSY)) {
+        printf("enter_io_uring: io_uring_enter failed (%s)\n", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+// the entry is queued right away, filling it in is up to the caller. NULL if the ring is full and can't be submitted
+struct io_uring_sqe* get_uring_sqe(IoUring *ring)
+{
+    if (ring->sq_pending_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) {
+        if ((enter_io_uring(ring, 0) != 0) || (ring->sq_pending_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries)) {
+            printf("get_uring_sqe: the submission queue is full\n");
+            return NULL;
+        }
+    }
+
+    const unsigned index = ring->sq_pending_tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    ring->sq_pending_tail++;
+    ring->in_flight++;
+    return sqe;
+}
+
+// a tls connection to a host, kept open between requests when the server allows it
+typedef struct Connection
+{
+    int sockfd;
+    SSL *ssl;
+    char host[256];
+    char port[8];
+    struct sockaddr_storage address;
+    socklen_t address_len;
+    bool reused;                // true if the connection served a request before this one
+    double last_used;           // time the connection was put back into the pool
+    double last_received;       // time data last arrived on the http/2 session
+    uint32_t watched_events;    // epoll events the engine waits for, 0 when the socket isn't registered
+    bool wants_write;           // the last tls read can only continue once the socket is writable
+    bool kernel_tls;            // the kernel decrypts received records, set once the handshake is done
+    struct HTTP_Task *task;     // the http/1.1 request using the connection
+    nghttp2_session *http2;     // set once ALPN settled on http/2, every request is then a stream of this session
+    size_t http2_streams;
+    Buffer output;              // http/2 frames or pipelined http/1.1 requests that haven't been written yet
+    size_t read_start;          // received bytes that haven't been parsed yet are in [read_start, read_end)
+    size_t read_end;
+    char read_buffer[16384];
+    
+    // io_uring backend only, openssl reads and writes tls records through memory BIOs that the ring fills and drains 
+    bool connected;
+    bool connecting;            // operations of the connection the ring hasn't completed
+    bool receiving;
+    bool sending;
+    bool closing;               // closed once the ring is done with it
+    int uring_slot;             // registered buffers of the connection, -1 if they are on the heap
+    char *uring_input;
+    char *uring_output;
+    size_t uring_output_start;  // tls records being sent are in [uring_output_start, uring_output_end) of 'uring_output'
+    size_t uring_output_end;
+    struct Connection *next;
+} Connection;
+
+uint64_t uring_user_data(Connection *connection, const int operation)
+{
+    return (uint64_t) (uintptr_t) connection | operation;
+}
+
+// the socket of a connection is connected by the ring, completing with the engine's on_uring_completion
+void submit_uring_connect(Connection *connection)
+{
+    struct io_uring_sqe *sqe = get_uring_sqe(&uring);
+    if (!sqe) return;
+
+    sqe->opcode = IORING_OP_CONNECT;
+    sqe->fd = connection->sockfd;
+    sqe->addr = (uint64_t) (uintptr_t) &connection->address;
+    sqe->off = connection->address_len;
+    sqe->user_data = uring_user_data(connection, URING_CONNECT);
+    connection->connecting = true;
+}
+
+// receives the next tls records of a connection into its input buffer
+void submit_uring_input(Connection *connection)
+{
+    if (connection->receiving || connection->closing) return;
+
+    struct io_uring_sqe *sqe = get_uring_sqe(&uring);
+    if (!sqe) return;
+
+    sqe->opcode = (connection->uring_slot >= 0) ? IORING_OP_READ_FIXED : IORING_OP_RECV;
+    sqe->fd = connection->sockfd;
+    sqe->addr = (uint64_t) (uintptr_t) connection->uring_input;
+    sqe->len = URING_BUFFER_SIZE;
+    sqe->buf_index = (connection->uring_slot >= 0) ? (connection->uring_slot * 2) : 0;
+    sqe->user_data = uring_user_data(connection, URING_RECEIVE);
+    connection->receiving = true;
+}
+
+// sends the tls records openssl wrote for the connection, one send at a time so that they leave in order
+void submit_uring_output(Connection *connection)
+{
+    if (connection->sending || connection->closing) return;
+
+    if (connection->uring_output_start == connection->uring_output_end) {
+        const int pending = BIO_read(SSL_get_wbio(connection->ssl), connection->uring_output, URING_BUFFER_SIZE);
+        if (pending <= 0) return;
+
+        connection->uring_output_start = 0;
+        connection->uring_output_end = pending;
+    }
+
+    struct io_uring_sqe *sqe = get_uring_sqe(&uring);
+    if (!sqe) return;
+
+    sqe->opcode = (connection->uring_slot >= 0) ? IORING_OP_WRITE_FIXED : IORING_OP_SEND;
+    sqe->fd = connection->sockfd;
+    sqe->addr = (uint64_t) (uintptr_t) &connection->uring_output[connection->uring_output_start];
+    sqe->len = connection->uring_output_end - connection->uring_output_start;
+    sqe->buf_index = (connection->uring_slot >= 0) ? (connection->uring_slot * 2 + 1) : 0;
+    sqe->user_data = uring_user_data(connection, URING_SEND);
+    connection->sending = true;
+}
+
+// asks the ring to give up on the operations of a connection, each still completes once
+void cancel_uring_operations(Connection *connection)
+{
+    const int operations[] = { URING_CONNECT, URING_RECEIVE, URING_SEND };
+    const bool in_flight[] = { connection->connecting, connection->receiving, connection->sending };
+    for (size_t i = 0; i < sizeof(operations) / sizeof(operations[0]); i++) {
+        if (!in_flight[i]) continue;
+
+        struct io_uring_sqe *sqe = get_uring_sqe(&uring);
+        if (!sqe) return;
+
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = uring_user_data(connection, operations[i]);
+        sqe->user_data = URING_CANCEL;
+    }
+}
+
+void close_connection(Connection *connection)
+{
+    if (!connection) return;
+
+    // the ring may still write into the connection, which is closed for good once its operations complete
+    if ((uring.fd >= 0) && (connection->connecting || connection->receiving || connection->sending)) {
+        if (!connection->closing) cancel_uring_operations(connection);
+        connection->closing = true;
+        return;
+    }
+
+    if (connection->http2) nghttp2_session_del(connection->http2);
+    free_buffer(&connection->output);
+
+    if (connection->ssl) {
+        SSL_shutdown(connection->ssl);
+        SSL_free(connection->ssl);
+    }
+
+    if (connection->sockfd >= 0) close(connection->sockfd);
+
+    if (connection->uring_slot >= 0) uring.free_slots[uring.free_slot_count++] = connection->uring_slot;
+    else free(connection->uring_input);
+    free(connection);
+}
+
+// starts a non-blocking connect to an address of host (see lookup_dns), NULL on failure
+// the tls handshake is left to the caller, the SSL object is ready for SSL_connect once the socket is writable
+Connection* open_connection(const char *host, const char *port, const struct sockaddr_storage *address, const socklen_t address_len, const bool allow_http2)
+{
+    Connection *connection = malloc(sizeof(Connection));
+    if (!connection) {
+        printf("open_connection: malloc returned NULL for connection\n");
+        return NULL;
+    }
+
+    connection->ssl = NULL;
+    connection->next = NULL;
+    connection->reused = false;
+    connection->last_used = 0;
+    connection->last_received = get_monotonic_time();
+    connection->watched_events = 0;
+    connection->wants_write = false;
+    connection->kernel_tls = false;
+    connection->task = NULL;
+    connection->http2 = NULL;
+    connection->http2_streams = 0;
+    connection->output = init_buffer();
+    connection->read_start = connection->read_end = 0;
+    connection->connected = connection->connecting = connection->receiving = connection->sending = connection->closing = false;
+    connection->uring_slot = -1;
+    connection->uring_input = connection->uring_output = NULL;
+    connection->uring_output_start = connection->uring_output_end = 0;
+    snprintf(connection->host, sizeof(connection->host), "%s", host);
+    snprintf(connection->port, sizeof(connection->port), "%s", port);
+    connection->address = *address;
+    connection->address_len = address_len;
+
+    // initializing socket
+    connection->sockfd = socket(address->ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (connection->sockfd < 0) {
+        printf("open_connection: socket failed\n");
+        free(connection);
+        return NULL;
+    }
+
+    // requests are written whole, holding back a small one until the previous is acknowledged only delays it
+    const int nodelay = 1;
+    setsockopt(connection->sockfd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+    // connection between socket and ip address, completes once the socket becomes writable
+    // with the io_uring backend, the engine submits the connect instead (see watch_connection)
+    if (!io_uring_backend && (connect(connection->sockfd, (const struct sockaddr*) address, address_len) != 0) && (errno != EINPROGRESS)) {
+        printf("open_connection: connect failed\n");
+        report_dns_failure(&dns_cache, host, port, address, address_len);
+        close_connection(connection);
+        return NULL;
+    }
+
+    connection->ssl = SSL_new(ctx);
+    if (!connection->ssl) {
+        printf("open_connection: SSL_new failed\n");
+        close_connection(connection);
+        return NULL;
+    }
+
+    if (io_uring_backend) {
+        BIO *input = BIO_new(BIO_s_mem());
+        BIO *output = BIO_new(BIO_s_mem());
+        if (!input || !output) {
+            printf("open_connection: BIO_new failed\n");
+            BIO_free(input);
+            BIO_free(output);
+            close_connection(connection);
+            return NULL;
+        }
+
+        // running out of input means the next receive hasn't completed yet, not that the peer closed the connection
+        BIO_set_mem_eof_return(input, -1);
+        SSL_set_bio(connection->ssl, input, output);
+
+        if (uring.free_slot_count > 0) {
+            connection->uring_slot = uring.free_slots[--uring.free_slot_count];
+            connection->uring_input = &uring.buffers[connection->uring_slot * 2 * URING_BUFFER_SIZE];
+            connection->uring_output = connection->uring_input + URING_BUFFER_SIZE;
+        }
+        else {
+            connection->uring_input = malloc(2 * URING_BUFFER_SIZE);
+            if (!connection->uring_input) {
+                printf("open_connection: malloc returned NULL for io_uring buffers\n");
+                close_connection(connection);
+                return NULL;
+            }
+            connection->uring_output = connection->uring_input + URING_BUFFER_SIZE;
+        }
+    }
+    else SSL_set_fd(connection->ssl, connection->sockfd);
+    SSL_set_tlsext_host_name(connection->ssl, host);
+
+    static const unsigned char http1_only[] = "\x08http/1.1";
+    if (!allow_http2 && (SSL_set_alpn_protos(connection->ssl, http1_only, sizeof(http1_only) - 1) != 0)) {
+        printf("open_connection: SSL_set_alpn_protos failed\n");
+    }
+
+    SSL_SESSION *session = find_tls_session(&tls_session_cache, host);
+    if (session) {
+        SSL_set_session(connection->ssl, session);
+        SSL_SESSION_free(session);
+    }
+
+    return connection;
+}
+
+// the peer may close an idle keep-alive connection at any time, 
+// an idle connection that is readable has either been closed or sent something we didn't ask for
+bool idle_connection_alive(Connection *connection)
+{
+    char c;
+    const ssize_t n = recv(connection->sockfd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (n < 0) return (errno == EAGAIN) || (errno == EWOULDBLOCK);
+    if (n == 0) return false;
+
+    // tls 1.3 servers send session tickets after the handshake, which a connection that never
+    // carried a request hasn't read yet, they are processed here and only application data counts
+    if (connection->uring_input) {
+        // a receive of the ring would race this one for the order of the records
+        if (connection->receiving) return true;
+
+        const ssize_t received = recv(connection->sockfd, connection->uring_input, URING_BUFFER_SIZE, MSG_DONTWAIT);
+        if (received > 0) BIO_write(SSL_get_rbio(connection->ssl), connection->uring_input, received);
+    }
+
+    ERR_clear_error();
+    const int peeked = SSL_peek(connection->ssl, &c, 1);
+    return (peeked <= 0) && (SSL_get_error(connection->ssl, peeked) == SSL_ERROR_WANT_READ);
+}
+
+#define TLS_RECORD_ALERT 21
+#define TLS_RECORD_APPLICATION_DATA 23
+#define KERNEL_TLS_NOT_DATA -2
+
+// reads decrypted application data from a connection whose records the kernel decrypts,
+// returns the bytes read, 0 if none are available yet and -1 when the connection can't be read this way.
+// a post-handshake message (a session ticket or key update) is left for openssl to read, KERNEL_TLS_NOT_DATA says so
+ssize_t recv_kernel_tls(Connection *connection, char *data, const size_t size)
+{
+    char control[CMSG_SPACE(sizeof(unsigned char))];
+    struct iovec iov = { .iov_base = data, .iov_len = 1 };
+    struct msghdr message = {0};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    // the type of the next record, a receive that isn't a peek would take it from openssl
+    ssize_t received = recvmsg(connection->sockfd, &message, MSG_DONTWAIT | MSG_PEEK);
+    if (received < 0) return ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? 0 : -1;
+    if (received == 0) return -1;
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    if (cmsg && (cmsg->cmsg_level == SOL_TLS) && (cmsg->cmsg_type == TLS_GET_RECORD_TYPE) && (*CMSG_DATA(cmsg) != TLS_RECORD_APPLICATION_DATA)) {
+        if (*CMSG_DATA(cmsg) != TLS_RECORD_ALERT) return KERNEL_TLS_NOT_DATA;
+        printf("recv_kernel_tls: %s sent an alert in the middle of a body\n", connection->host);
+        return -1;
+    }
+
+    iov.iov_len = size;
+    message.msg_controllen = sizeof(control);
+    received = recvmsg(connection->sockfd, &message, MSG_DONTWAIT);
+    if (received < 0) return ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? 0 : -1;
+    return (received == 0) ? -1 : received;
+}
+
+#define MAX_IDLE_CONNECTIONS_PER_HOST 8
+#define IDLE_CONNECTION_TIMEOUT 30 // seconds before an unused connection is closed
+
+// idle connections to a single host, most recently used first
+typedef struct HostConnections
+{
+    char host[256];
+    char port[8];
+    size_t count;
+    Connection *head;
+    struct HostConnections *next;
+} HostConnections;
+
+// thread-safe collection of idle keep-alive connections, grouped by host
+typedef struct
+{
+    HostConnections *hosts;
+    pthread_mutex_t mutex;
+} ConnectionPool;
+
+static ConnectionPool connection_pool;
+
+ConnectionPool init_connection_pool()
+{
+    ConnectionPool pool;
+    pool.hosts = NULL;
+    pthread_mutex_init(&pool.mutex, NULL);
+    return pool;
+}
+
+// expects the pool's mutex to be held
+HostConnections* find_host_connections(ConnectionPool *pool, const char *host, const char *port)
+{
+    for (HostConnections *current = pool->hosts; current; current = current->next) {
+        if ((strcmp(current->host, host) == 0) && (strcmp(current->port, port) == 0)) {
+            return current;
+        }
+    }
+
+    HostConnections *host_connections = malloc(sizeof(HostConnections));
+    if (!host_connections) {
+        printf("find_host_connections: malloc returned NULL for host_connections\n");
+        return NULL;
+    }
+
+    snprintf(host_connections->host, sizeof(host_connections->host), "%s", host);
+    snprintf(host_connections->port, sizeof(host_connections->port), "%s", port);
+    host_connections->count = 0;
+    host_connections->head = NULL;
+    host_connections->next = pool->hosts;
+    pool->hosts = host_connections;
+
+    return host_connections;
+}
+
+// closes every idle connection of the host that went unused for too long, expects the pool's mutex to be held
+void evict_idle_connections(HostConnections *host_connections, const double now)
+{
+    Connection **link = &host_connections->head;
+    while (*link) {
+        Connection *connection = *link;
+        if ((now - connection->last_used) > IDLE_CONNECTION_TIMEOUT) {
+            *link = connection->next;
+            host_connections->count--;
+            close_connection(connection);
+        }
+        else link = &connection->next;
+    }
+}
+
+// returns an idle connection to host if one is availible, NULL otherwise
+Connection* checkout_connection(ConnectionPool *pool, const char *host, const char *port)
+{
+    Connection *connection = NULL;
+
+    pthread_mutex_lock(&pool->mutex);
+        HostConnections *host_connections = find_host_connections(pool, host, port);
+        if (host_connections) {
+            evict_idle_connections(host_connections, get_monotonic_time());
+            while (host_connections->head && !connection) {
+                connection = host_connections->head;
+                host_connections->head = connection->next;
+                host_connections->count--;
+                
+                if (!idle_connection_alive(connection)) {
+                    close_connection(connection);
+                    connection = NULL;
+                }
+            }
+        }
+    pthread_mutex_unlock(&pool->mutex);
+
+    if (connection) {
+        connection->next = NULL;
+        connection->reused = true;
+    }
+
+    return connection;
+}
+
+// the idle connections to host that could still carry a request, those the host closed or that went unused for too long are closed on the way
+size_t count_idle_connections(ConnectionPool *pool, const char *host, const char *port)
+{
+    size_t count = 0;
+
+    pthread_mutex_lock(&pool->mutex);
+        HostConnections *host_connections = find_host_connections(pool, host, port);
+        if (host_connections) {
+            evict_idle_connections(host_connections, get_monotonic_time());
+
+            Connection **link = &host_connections->head;
+            while (*link) {
+                Connection *connection = *link;
+                if (!idle_connection_alive(connection)) {
+                    *link = connection->next;
+                    host_connections->count--;
+                    close_connection(connection);
+                }
+                else link = &connection->next;
+            }
+            count = host_connections->count;
+        }
+    pthread_mutex_unlock(&pool->mutex);
+
+    return count;
+}
+
+// hands a connection that is ready for another request back to the pool
+void return_connection(ConnectionPool *pool, Connection *connection)
+{
+    if (!connection) return;
+
+    // the end of a handshake may still wait to be sent by the ring
+    if (connection->uring_output) submit_uring_output(connection);
+
+    pthread_mutex_lock(&pool->mutex);
+        HostConnections *host_connections = find_host_connections(pool, connection->host, connection->port);
+        if (!host_connections || (host_connections->count >= MAX_IDLE_CONNECTIONS_PER_HOST)) {
+            close_connection(connection);
+        }
+
+        else {
+            connection->last_used = get_monotonic_time();
+            connection->next = host_connections->head;
+            host_connections->head = connection;
+            host_connections->count++;
+        }
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+// closes every idle connection, the engine does so before it stops so that the ring can still cancel their receives
+void close_idle_connections(ConnectionPool *pool)
+{
+    pthread_mutex_lock(&pool->mutex);
+        while (pool->hosts) {
+            HostConnections *host_connections = pool->hosts;
+            pool->hosts = host_connections->next;
+
+            while (host_connections->head) {
+                Connection *to_close = host_connections->head;
+                host_connections->head = to_close->next;
+                close_connection(to_close);
+            }
+
+            free(host_connections);
+        }
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+void free_connection_pool(ConnectionPool *pool)
+{
+    close_idle_connections(pool);
+    pthread_mutex_destroy(&pool->mutex);
+}
+
+// writes as much of the pending output as the socket takes, 1 once all of it is written, 0 if the socket is full, -1 on error
+// a blocked write has to be retried with at least the same bytes, which stay at the front of the buffer
+int flush_connection_output(Connection *connection)
+{
+    Buffer *output = &connection->output;
+    while (output->size > 0) {
+        ERR_clear_error();
+        const int written = SSL_write(connection->ssl, output->data, output->size);
+        if (written <= 0) {
+            const int error = SSL_get_error(connection->ssl, written);
+            if ((error == SSL_ERROR_WANT_WRITE) || (error == SSL_ERROR_WANT_READ)) {
+                connection->wants_write |= (error == SSL_ERROR_WANT_WRITE);
+                return 0;
+            }
+
+            printf("flush_connection_output: SSL_write to %s failed\n", connection->host);
+            return -1;
+        }
+
+        memmove(output->data, &output->data[written], output->size - written);
+        output->size -= written;
+    }
+
+    return 1;
+}
+
+// pulls the next event of the response arriving on the connection, reading from the socket in large blocks 
+// whenever the buffered bytes run out. body slices point into the connection's read buffer
+// the socket is non-blocking, HTTP_NEED_MORE means the caller has to wait for it (see 'wants_write')
+HTTP_Event read_http_event(Connection *connection, HTTP_Response *response, const char **body, size_t *body_len)
+{
+    while (true) {
+        size_t consumed;
+        const HTTP_Event event = parse_http_response(response, &connection->read_buffer[connection->read_start], connection->read_end - connection->read_start, &consumed, body, body_len);
+        connection->read_start += consumed;
+        if (event != HTTP_NEED_MORE) {
+            return event;
+        }
+
+        // keep the unparsed part of a line at the front and fill the space after it
+        if (connection->read_start > 0) {
+            memmove(connection->read_buffer, &connection->read_buffer[connection->read_start], connection->read_end - connection->read_start);
+            connection->read_end -= connection->read_start;
+            connection->read_start = 0;
+        }
+
+        if (connection->read_end == sizeof(connection->read_buffer)) {
+            printf("read_http_event: line exceeds %zu bytes\n", sizeof(connection->read_buffer));
+            return HTTP_ERROR;
+        }
+
+        ERR_clear_error();
+        const int read = SSL_read(connection->ssl, &connection->read_buffer[connection->read_end], sizeof(connection->read_buffer) - connection->read_end);
+        if (read <= 0) {
+            const int error = SSL_get_error(connection->ssl, read);
+            if ((error == SSL_ERROR_WANT_READ) || (error == SSL_ERROR_WANT_WRITE)) {
+                connection->wants_write = (error == SSL_ERROR_WANT_WRITE);
+                return HTTP_NEED_MORE;
+            }
+
+            if (response->state == PARSING_BODY_UNTIL_CLOSE) {
+                response->state = PARSING_DONE;
+                continue;
+            }
+
+            printf("read_http_event: SSL_read returned %d (error %d)\n", read, error);
+            return HTTP_ERROR;
+        }
+
+        connection->read_end += read;
+    }
+}
+
+#define RESPONSE_CACHE_MAX_BYTES (64 * 1024 * 1024)
+
+// bodies of responses that came with validators or a max-age, a repeated request is answered from here 
+// without asking the server while the response is fresh, and with a conditional request once it is stale
+typedef struct CachedResponse
+{
+    char host[256];
+    char path[256];
+    char etag[128];
+    char last_modified[64];
+    double fresh_until;             // monotonic time
+    Buffer body;                    // decoded
+    struct CachedResponse *prev;    // most recently used first
+    struct CachedResponse *next;
+} CachedResponse;
+
+typedef struct
+{
+    CachedResponse *head;
+    CachedResponse *tail;
+    size_t bytes;
+    size_t fresh_hits;
+    size_t revalidated;     // answered with 304 Not Modified
+    size_t stored;
+    pthread_mutex_t mutex;
+} ResponseCache;
+
+static ResponseCache response_cache;
+
+typedef enum
+{
+    CACHE_MISS,
+    CACHE_FRESH,    // the cached body can be used as is
+    CACHE_STALE,    // the cached body has to be revalidated with the server first
+} CacheResult;
+
+ResponseCache init_response_cache()
+{
+    ResponseCache cache;
+    cache.head = cache.tail = NULL;
+    cache.bytes = 0;
+    cache.fresh_hits = cache.revalidated = cache.stored = 0;
+    pthread_mutex_init(&cache.mutex, NULL);
+    return cache;
+}
+
+// seconds a response may be used without revalidation, from the max-age of its Cache-Control minus its Age
+double response_max_age(const char *header)
+{
+    char value[256];
+    if (!http_header_value(header, "Cache-Control", sizeof(value), value) || http_header_has_token(header, "Cache-Control", "no-cache")) {
+        return 0;
+    }
+
+    for (const char *current = value; *current; current++) {
+        const bool directive_start = (current == value) || (current[-1] == ',') || isspace((unsigned char)current[-1]);
+        if (directive_start && (strncasecmp(current, "max-age=", 8) == 0)) {
+            double seconds = atof(&current[8]);
+
+            char age[32];
+            if (http_header_value(header, "Age", sizeof(age), age)) seconds -= atof(age);
+            return (seconds > 0) ? seconds : 0;
+        }
+    }
+
+    return 0;
+}
+
+// expects the cache to be locked
+CachedResponse* find_cached_response(ResponseCache *cache, const char *host, const char *path)
+{
+    for (CachedResponse *current = cache->head; current; current = current->next) {
+        if ((strcmp(current->path, path) == 0) && (strcmp(current->host, host) == 0)) {
+            return current;
+        }
+    }
+    return NULL;
+}
+
+// expects the cache to be locked
+void unlink_cached_response(ResponseCache *cache, CachedResponse *entry)
+{
+    if (entry->prev) entry->prev->next = entry->next;
+    else cache->head = entry->next;
+    if (entry->next) entry->next->prev = entry->prev;
+    else cache->tail = entry->prev;
+    entry->prev = entry->next = NULL;
+}
+
+// expects the cache to be locked
+void push_cached_response(ResponseCache *cache, CachedResponse *entry)
+{
+    entry->prev = NULL;
+    entry->next = cache->head;
+    if (cache->head) cache->head->prev = entry;
+    else cache->tail = entry;
+    cache->head = entry;
+}
+
+// expects the cache to be locked
+void remove_cached_response(ResponseCache *cache, CachedResponse *entry)
+{
+    unlink_cached_response(cache, entry);
+    cache->bytes -= entry->body.size;
+    free_buffer(&entry->body);
+    free(entry);
+}
+
+// a copy of the cached body is written into 'body' when the response is fresh, 
+// the conditional header fields that revalidate it go to 'conditions' when it is stale
+CacheResult check_response_cache(ResponseCache *cache, const char *host, const char *path, const size_t n, char conditions[n], Buffer *body)
+{
+    CacheResult result = CACHE_MISS;
+    conditions[0] = '\0';
+
+    pthread_mutex_lock(&cache->mutex);
+        CachedResponse *entry = find_cached_response(cache, host, path);
+        if (entry && (get_monotonic_time() < entry->fresh_until)) {
+            body->size = 0;
+            write_data_to_buffer(body, entry->body.data, entry->body.size);
+            if (buffer_ready(body)) {
+                cache->fresh_hits++;
+                result = CACHE_FRESH;
+            }
+        }
+
+        else if (entry && (entry->etag[0] || entry->last_modified[0])) {
+            int len = 0;
+            if (entry->etag[0]) len += snprintf(&conditions[len], n - len, "If-None-Match: %s\r\n", entry->etag);
+            if (entry->last_modified[0] && (len < (int) n)) snprintf(&conditions[len], n - len, "If-Modified-Since: %s\r\n", entry->last_modified);
+            result = CACHE_STALE;
+        }
+
+        if (entry) {
+            unlink_cached_response(cache, entry);
+            push_cached_response(cache, entry);
+        }
+    pthread_mutex_unlock(&cache->mutex);
+
+    return result;
+}
+
+// keeps a copy of a complete 200 response whose header allows it and gives something to revalidate or reuse it with
+void store_cached_response(ResponseCache *cache, const char *host, const char *path, const char *header, const Buffer *body)
+{
+    if (!buffer_ready(body) || (body->size > RESPONSE_CACHE_MAX_BYTES / 4) || http_header_has_token(header, "Cache-Control", "no-store")) {
+        return;
+    }
+
+    CachedResponse *new_entry = malloc(sizeof(CachedResponse));
+    if (!new_entry) {
+        printf("store_cached_response: malloc returned NULL for new_entry\n");
+        return;
+    }
+
+    const bool has_etag = http_header_value(header, "ETag", sizeof(new_entry->etag), new_entry->etag);
+    const bool has_last_modified = http_header_value(header, "Last-Modified", sizeof(new_entry->last_modified), new_entry->last_modified);
+    const double max_age = response_max_age(header);
+    if (!has_etag) new_entry->etag[0] = '\0';
+    if (!has_last_modified) new_entry->last_modified[0] = '\0';
+
+    if (!has_etag && !has_last_modified && (max_age <= 0)) {
+        free(new_entry);
+        return;
+    }
+
+    snprintf(new_entry->host, sizeof(new_entry->host), "%s", host);
+    snprintf(new_entry->path, sizeof(new_entry->path), "%s", path);
+    new_entry->fresh_until = get_monotonic_time() + max_age;
+    new_entry->body = init_buffer();
+    write_data_to_buffer(&new_entry->body, body->data, body->size);
+    if (!buffer_ready(&new_entry->body)) {
+        free(new_entry);
+        return;
+    }
+
+    pthread_mutex_lock(&cache->mutex);
+        CachedResponse *old_entry = find_cached_response(cache, host, path);
+        if (old_entry) remove_cached_response(cache, old_entry);
+
+        push_cached_response(cache, new_entry);
+        cache->bytes += new_entry->body.size;
+        cache->stored++;
+
+        // least recently used responses make room
+        while (cache->bytes > RESPONSE_CACHE_MAX_BYTES) {
+            remove_cached_response(cache, cache->tail);
+        }
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+// answers a 304 Not Modified with a copy of the cached body, whose freshness the 304 renews, false if it is gone
+bool revalidate_cached_response(ResponseCache *cache, const char *host, const char *path, const char *header, Buffer *body)
+{
+    bool found = false;
+
+    pthread_mutex_lock(&cache->mutex);
+        CachedResponse *entry = find_cached_response(cache, host, path);
+        if (entry) {
+            entry->fresh_until = get_monotonic_time() + response_max_age(header);
+            // a 304 may carry new validators, those it leaves out are still good
+            http_header_value(header, "ETag", sizeof(entry->etag), entry->etag);
+            http_header_value(header, "Last-Modified", sizeof(entry->last_modified), entry->last_modified);
+
+            body->size = 0;
+            write_data_to_buffer(body, entry->body.data, entry->body.size);
+            found = buffer_ready(body);
+            if (found) cache->revalidated++;
+        }
+    pthread_mutex_unlock(&cache->mutex);
+
+    return found;
+}
+
+void print_response_cache_stats(ResponseCache *cache)
+{
+    pthread_mutex_lock(&cache->mutex);
+        printf("response cache: %zu stored (%.1f MB held), %zu fresh hits, %zu revalidated with 304\n", 
+               cache->stored, cache->bytes / (1024.0 * 1024.0), cache->fresh_hits, cache->revalidated);
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+void free_response_cache(ResponseCache *cache)
+{
+    while (cache->head) {
+        remove_cached_response(cache, cache->head);
+    }
+
+    pthread_mutex_destroy(&cache->mutex);
+}
+
+// called on the engine thread once a request completes, the buffer is empty if the request failed
+// the callback owns the buffer and should return quickly, heavy work belongs on the worker pool
+typedef void (*HTTP_Callback)(Buffer response, void *user_data);
+
+typedef enum
+{
+    TASK_WAITING,       // waiting for a connection slot to the host
+    TASK_RESOLVING,     // has a slot, waiting for the host's address
+    TASK_CONNECTING,
+    TASK_HANDSHAKING,
+    TASK_SENDING,
+    TASK_RECEIVING,
+    TASK_STREAMING,     // sent as a stream of a shared http/2 connection
+    TASK_PIPELINED,     // written behind other requests on an http/1.1 connection, waits for their responses
+} HTTP_TaskState;
+
+// how the received body is turned into the response buffer
+typedef enum
+{
+    BODY_UNDECIDED,     // no body bytes have arrived yet
+    BODY_IDENTITY,
+    BODY_INFLATING,     // gzip or deflate, decompressed as it arrives
+    BODY_INFLATED,      // the compressed stream ended
+} BodyCoding;
+
+// a request owned by the http engine
+typedef struct HTTP_Task
+{
+    HTTP_TaskState state;
+    HTTP_Request request;
+    char out[2048];             // header and body of the request, as written to the connection
+    size_t out_len;
+    bool retried;
+    size_t retries;             // of transient failures, each one after a backoff
+    double retry_at;            // the task stays waiting until then
+    double deadline;
+    bool counted;               // takes up one of the requests its host's concurrency limit allows (see 'limited')
+    bool probe;                 // the one request a half open circuit lets through
+    bool cached;                // the response came fresh out of the cache, the engine only completes the task
+    double started_at;          // when the task left the waiting list, 0 while it waits
+    double sent_at;             // when its request was queued on a connection, the latency of a limited request counts from here
+    bool probing_protocol;      // opens the connection that tells through ALPN whether the host speaks http/2
+    int32_t stream_id;          // of the http/2 stream carrying the request
+    Connection *connection;
+
+    // requests pipelined behind this one on its connection, in the order their responses arrive
+    struct HTTP_Task *pipeline_next;
+    struct HTTP_Task *pipeline_tail;
+    size_t pipeline_depth;      // number of requests in the pipeline, including this one
+
+    // connects to the addresses of the host are raced (RFC 8305), the first one to succeed becomes 'connection'
+    AddressList candidates;
+    size_t next_candidate;
+    Connection *attempts[MAX_DNS_ADDRESSES];
+    size_t attempt_count;
+    double next_attempt_at;     // when a connect to the next candidate starts if none succeeded by then
+    double connect_started;
+    RequestTimings timings;
+    ObjectExtractor extractor;  // of 'request.extract_object'
+
+    HTTP_Response http_response;
+    BodyCoding body_coding;
+    z_stream inflater;
+    Buffer response;
+    HTTP_Callback callback;
+    void *user_data;
+    struct HTTP_Task *prev;
+    struct HTTP_Task *next;
+} HTTP_Task;
+
+#define MAX_CONNECTIONS_PER_HOST 16
+#define CONNECT_ATTEMPT_DELAY 0.25  // seconds between raced connects, as recommended by RFC 8305
+#define CONNECT_TIME_SAMPLES 1024
+
+// when false, the next address is only tried after connecting to the previous one failed
+static bool happy_eyeballs = true;
+#define MAX_HTTP2_STREAMS 100
+#define MAX_PIPELINE_DEPTH 6
+
+// limited requests to a host adapt their concurrency like tcp does its window: additive increase while responses are quick,
+// multiplicative decrease on failures or once the latency rises well above the fastest recently seen
+#define INITIAL_CONCURRENCY_LIMIT 4
+#define MAX_CONCURRENCY_LIMIT 32
+#define CONGESTED_LATENCY_FACTOR 2.0
+#define LATENCY_SLACK 0.05    // seconds of jitter that never count as congestion
+#define MIN_LATENCY_WINDOW 10 // seconds the fastest latency is remembered for
+
+// transient failures (reset connections, 5xx, 429) are retried after a jittered exponential backoff,
+// as long as the retries of a host stay a small share of its requests
+#define MAX_RETRIES 3
+#define RETRY_BASE_DELAY 0.2  // seconds
+#define MAX_RETRY_DELAY 4.0
+#define RETRY_BUDGET_RATIO 0.2 // retries earned by every first attempt
+#define RETRY_BUDGET_BURST 10.0
+
+// after enough failures in a row a host's circuit opens: its requests fail right away instead of waiting for timeouts,
+// a probe connection is tried once the open time is over and closes the circuit again if it succeeds
+#define CIRCUIT_FAILURE_THRESHOLD 5
+#define CIRCUIT_OPEN_TIME 5.0   // seconds, doubled every time a probe fails
+#define MAX_CIRCUIT_OPEN_TIME 60.0
+
+typedef enum
+{
+    CIRCUIT_CLOSED,
+    CIRCUIT_OPEN,
+    CIRCUIT_HALF_OPEN,  // a probe is on its way, nothing else goes through until it answers
+} CircuitState;
+
+// what ALPN settled on for the host, for requests that allow http/2
+typedef enum
+{
+    PROTOCOL_UNKNOWN,
+    PROTOCOL_HTTP1,
+    PROTOCOL_HTTP2,
+} HostProtocol;
+
+// the durations of every phase of the requests to a host, bucket i counts those below 2^i ms (the last one also the slower ones)
+#define TIMING_BUCKETS 16
+
+typedef enum
+{
+    PHASE_QUEUED,
+    PHASE_DNS,
+    PHASE_CONNECT,
+    PHASE_TLS,
+    PHASE_FIRST_BYTE,   // from sending the request (or the handshake) to the first byte of the response
+    PHASE_TRANSFER,
+    PHASE_TOTAL,
+} RequestPhase;
+#define N_REQUEST_PHASES 7
+
+typedef struct
+{
+    size_t counts[N_REQUEST_PHASES][TIMING_BUCKETS];
+    size_t samples[N_REQUEST_PHASES];
+    double seconds[N_REQUEST_PHASES];
+    size_t requests;
+    size_t failures;
+    size_t reused;          // requests that went over an open connection
+    size_t bytes_sent;
+    size_t bytes_received;
+} HostTimings;
+
+// bookkeeping of the engine for a single host
+typedef struct HostState
+{
+    char host[256];
+    char port[8];
+    size_t active_connections;
+    HostProtocol protocol;
+    bool probing_protocol;          // a connection that will reveal the protocol is being established
+    Connection *http2_connection;   // shared by every http/2 request to the host
+    struct HTTP_Task *pipeline;     // holds the http/1.1 connection further requests are pipelined on
+    bool pipelining_broken;         // the host closed a connection with pipelined requests left, every request gets its own connection
+
+    // adaptive concurrency of the limited requests
+    double concurrency_limit;
+    size_t limited_in_flight;
+    double latency;                 // moving average of the limited requests' latency
+    double min_latency;
+    double min_latency_expires;
+    double last_decrease;
+    size_t decreases;
+
+    // retry budget and circuit breaker
+    double retry_tokens;
+    size_t retries;
+    CircuitState circuit;
+    size_t consecutive_failures;
+    double circuit_open_until;      // when the next probe goes out, or gives up while half open
+    double circuit_open_time;
+    bool probe_sent;                // a request already went through as the probe of the half open circuit
+    size_t circuit_trips;
+    HostTimings timings;
+    struct HostState *next;
+} HostState;
+
+// a single thread that drives every request over non-blocking sockets with epoll
+typedef struct
+{
+    int epoll_fd;               // -1 when the io_uring backend is used instead
+    IoUring *uring;
+    int wake_fd;                // eventfd, signaled when a request is submitted or the engine should stop
+    uint64_t wake_count;        // read from 'wake_fd' by the ring
+    bool running;
+    pthread_t thread;
+    
+    // handed over by other threads, guarded by 'mutex'
+    pthread_mutex_t mutex;      
+    HTTP_Task *submitted_head;
+    HTTP_Task *submitted_tail;
+    bool cancel_requested;      // a cancel token was cancelled, requests holding it are dropped right away
+    
+    // only touched by the engine thread
+    HTTP_Task *waiting_head;    // in submission order
+    HTTP_Task *waiting_tail;
+    HTTP_Task *active;          
+    HostState *hosts;
+    double next_deadline_check;
+    double next_connect_attempt;        // earliest 'next_attempt_at' of the connecting tasks
+    double next_retry;                  // earliest 'retry_at' of the waiting tasks
+    double next_probe;                  // when the circuit of a host is due for a probe
+    unsigned random_seed;               // for the jitter of retries
+    bool stopping;                      // the loop ended, whatever is left fails without retries
+    size_t open_circuits;               // read by other threads
+    Connection *retired_connections;    // closed once the events of the current epoll_wait are handled
+    
+    // time from the first connect of a task to its first established socket, the most recent samples
+    double connect_times[CONNECT_TIME_SAMPLES];
+    size_t connect_count;
+} HttpEngine;
+
+static HttpEngine http_engine;
+
+HostState* find_host_state(HttpEngine *engine, const char *host, const char *port)
+{
+    for (HostState *current = engine->hosts; current; current = current->next) {
+        if ((strcmp(current->host, host) == 0) && (strcmp(current->port, port) == 0)) {
+            return current;
+        }
+    }
+
+    HostState *host_state = malloc(sizeof(HostState));
+    if (!host_state) {
+        printf("find_host_state: malloc returned NULL for host_state\n");
+        return NULL;
+    }
+
+    snprintf(host_state->host, sizeof(host_state->host), "%s", host);
+    snprintf(host_state->port, sizeof(host_state->port), "%s", port);
+    host_state->active_connections = 0;
+    host_state->protocol = PROTOCOL_UNKNOWN;
+    host_state->probing_protocol = false;
+    host_state->http2_connection = NULL;
+    host_state->pipeline = NULL;
+    host_state->pipelining_broken = false;
+    host_state->concurrency_limit = INITIAL_CONCURRENCY_LIMIT;
+    host_state->limited_in_flight = 0;
+    host_state->latency = 0;
+    host_state->min_latency = INFINITY;
+    host_state->min_latency_expires = 0;
+    host_state->last_decrease = 0;
+    host_state->decreases = 0;
+    host_state->retry_tokens = RETRY_BUDGET_BURST;
+    host_state->retries = 0;
+    host_state->circuit = CIRCUIT_CLOSED;
+    host_state->consecutive_failures = 0;
+    host_state->circuit_open_until = 0;
+    host_state->circuit_open_time = CIRCUIT_OPEN_TIME;
+    host_state->probe_sent = false;
+    host_state->circuit_trips = 0;
+    memset(&host_state->timings, 0, sizeof(host_state->timings));
+    host_state->next = engine->hosts;
+    engine->hosts = host_state;
+
+    return host_state;
+}
+
+// true if another limited request to the host may start
+bool below_concurrency_limit(const HostState *host_state)
+{
+    return host_state->limited_in_flight < (size_t) host_state->concurrency_limit;
+}
+
+// feeds the outcome of a limited request that started at 'started_at' into the concurrency limit of its host
+void update_concurrency_limit(HostState *host_state, const double started_at, const double latency, const bool failed, const double now)
+{
+    // a request that failed before it was sent has no latency, only its failure counts
+    if (latency >= 0) {
+        host_state->latency = (host_state->latency > 0) ? (0.8 * host_state->latency + 0.2 * latency) : latency;
+
+        if (!failed && ((latency < host_state->min_latency) || (now >= host_state->min_latency_expires))) {
+            host_state->min_latency = latency;
+            host_state->min_latency_expires = now + MIN_LATENCY_WINDOW;
+        }
+    }
+
+    const bool congested = failed || (latency > (CONGESTED_LATENCY_FACTOR * host_state->min_latency + LATENCY_SLACK));
+    if (!congested) {
+        host_state->concurrency_limit += 1 / host_state->concurrency_limit;
+        if (host_state->concurrency_limit > MAX_CONCURRENCY_LIMIT) host_state->concurrency_limit = MAX_CONCURRENCY_LIMIT;
+        return;
+    }
+
+    // requests that started before the last decrease saw the same congestion, it only counts once
+    if (started_at < host_state->last_decrease) return;
+
+    host_state->concurrency_limit /= 2;
+    if (host_state->concurrency_limit < 1) host_state->concurrency_limit = 1;
+    host_state->last_decrease = now;
+    host_state->decreases++;
+    printf("update_concurrency_limit: %s %s, limit lowered to %.1f (latency %.0f ms, fastest %.0f ms)\n", 
+           host_state->host, failed ? "failed a request" : "slowed down", host_state->concurrency_limit, host_state->latency * 1000, host_state->min_latency * 1000);
+}
+
+// the task no longer takes up a request of its host's limit, 'latency' is < 0 if it didn't complete
+void uncount_limited_task(HttpEngine *engine, HTTP_Task *task, const double latency, const bool failed)
+{
+    if (!task->counted) return;
+    task->counted = false;
+
+    HostState *host_state = find_host_state(engine, task->request.host, task->request.port);
+    if (!host_state) return;
+
+    host_state->limited_in_flight--;
+    if ((latency >= 0) || failed) update_concurrency_limit(host_state, task->started_at, latency, failed, get_monotonic_time());
+}
+
+// expects the engine thread to be stopped
+void print_concurrency_limits(HttpEngine *engine)
+{
+    for (HostState *host_state = engine->hosts; host_state; host_state = host_state->next) {
+        if (host_state->latency == 0) continue;
+        printf("concurrency of %s: limit %.1f, latency %.0f ms (fastest %.0f ms), lowered %zu times\n", 
+               host_state->host, host_state->concurrency_limit, host_state->latency * 1000, host_state->min_latency * 1000, host_state->decreases);
+    }
+}
+
+// expects the engine thread to be stopped
+void print_retry_stats(HttpEngine *engine)
+{
+    for (HostState *host_state = engine->hosts; host_state; host_state = host_state->next) {
+        if ((host_state->retries == 0) && (host_state->circuit_trips == 0)) continue;
+        printf("retries of %s:%s: %zu, circuit opened %zu times%s\n", host_state->host, host_state->port, host_state->retries, host_state->circuit_trips, 
+               (host_state->circuit != CIRCUIT_CLOSED) ? " (still open)" : "");
+    }
+}
+
+char* request_phase_to_text(const RequestPhase phase)
+{
+    switch (phase) {
+        case PHASE_QUEUED: return "queued";
+        case PHASE_DNS: return "dns";
+        case PHASE_CONNECT: return "connect";
+        case PHASE_TLS: return "tls";
+        case PHASE_FIRST_BYTE: return "first byte";
+        case PHASE_TRANSFER: return "transfer";
+        case PHASE_TOTAL: return "total";
+        default:
+            printf("request_phase_to_text: passed RequestPhase is invalid\n");
+            return NULL;
+    }
+}
+
+// how long the phase took in seconds, -1 if the request skipped it
+double request_phase_duration(const RequestTimings *timings, const RequestPhase phase)
+{
+    double start, end;
+    switch (phase) {
+        case PHASE_QUEUED: start = timings->submitted; end = timings->started; break;
+        case PHASE_DNS: start = timings->started; end = timings->resolved; break;
+        case PHASE_CONNECT: start = timings->resolved; end = timings->connected; break;
+        case PHASE_TLS: start = timings->connected; end = timings->handshaken; break;
+        case PHASE_FIRST_BYTE: start = (timings->handshaken > 0) ? timings->handshaken : timings->started; end = timings->first_byte; break;
+        case PHASE_TRANSFER: start = timings->first_byte; end = timings->finished; break;
+        case PHASE_TOTAL: start = timings->submitted; end = timings->finished; break;
+        default: return -1;
+    }
+
+    return ((start > 0) && (end >= start)) ? (end - start) : -1;
+}
+
+int timing_bucket(const double seconds)
+{
+    int bucket = 0;
+    for (double limit = 0.001; (seconds >= limit) && (bucket < TIMING_BUCKETS - 1); limit *= 2) bucket++;
+    return bucket;
+}
+
+// adds a finished attempt to the histograms of its host
+void record_request_timings(HostTimings *host_timings, const RequestTimings *timings, const bool failed)
+{
+    if (failed) {
+        host_timings->failures++;
+        return;
+    }
+
+    host_timings->requests++;
+    if (timings->handshaken == 0) host_timings->reused++;
+    host_timings->bytes_sent += timings->bytes_sent;
+    host_timings->bytes_received += timings->bytes_received;
+
+    for (int phase = 0; phase < N_REQUEST_PHASES; phase++) {
+        const double duration = request_phase_duration(timings, phase);
+        if (duration < 0) continue;
+
+        host_timings->counts[phase][timing_bucket(duration)]++;
+        host_timings->samples[phase]++;
+        host_timings->seconds[phase] += duration;
+    }
+}
+
+// upper bound in ms of the bucket the given share of the samples falls into
+double timing_percentile(const size_t counts[TIMING_BUCKETS], const size_t samples, const double share)
+{
+    size_t seen = 0;
+    for (int i = 0; i < TIMING_BUCKETS; i++) {
+        seen += counts[i];
+        if (seen >= share * samples) return 1 << i;
+    }
+    return 1 << (TIMING_BUCKETS - 1);
+}
+
+// called by the engine thread, or once it stopped
+void print_request_timings(HttpEngine *engine)
+{
+    for (HostState *host_state = engine->hosts; host_state; host_state = host_state->next) {
+        const HostTimings *timings = &host_state->timings;
+        if ((timings->requests == 0) && (timings->failures == 0)) continue;
+
+        printf("timings of %s:%s: %zu requests (%zu on open connections), %zu failed, %.1f kB sent, %.1f kB received\n", 
+               host_state->host, host_state->port, timings->requests, timings->reused, timings->failures, 
+               timings->bytes_sent / 1024.0, timings->bytes_received / 1024.0);
+
+        for (int phase = 0; phase < N_REQUEST_PHASES; phase++) {
+            const size_t samples = timings->samples[phase];
+            if (samples == 0) continue;
+
+            printf("  %-10s %5zu, mean %7.1f ms, p50 < %.0f ms, p90 < %.0f ms, p99 < %.0f ms |", request_phase_to_text(phase), samples, 
+                   (timings->seconds[phase] / samples) * 1000, timing_percentile(timings->counts[phase], samples, 0.5), 
+                   timing_percentile(timings->counts[phase], samples, 0.9), timing_percentile(timings->counts[phase], samples, 0.99));
+            for (int i = 0; i < TIMING_BUCKETS; i++) printf(" %zu", timings->counts[phase][i]);
+            printf("\n");
+        }
+    }
+}
+
+void print_request_phases(const char *label, const RequestTimings *timings)
+{
+    printf("%s:", label);
+    for (int phase = 0; phase < N_REQUEST_PHASES; phase++) {
+        const double duration = request_phase_duration(timings, phase);
+        if (duration >= 0) printf(" %s %.1f ms,", request_phase_to_text(phase), duration * 1000);
+        else printf(" %s -,", request_phase_to_text(phase));
+    }
+    printf(" %zu bytes sent, %zu received\n", timings->bytes_sent, timings->bytes_received);
+}
+
+// set by SIGUSR1, the engine thread prints the timings of every host once it wakes up
+static volatile sig_atomic_t timings_dump_requested = 0;
+
+void request_timings_dump(int signal_number)
+{
+    timings_dump_requested = 1;
+
+    // only async-signal-safe calls in here
+    const uint64_t one = 1;
+    const ssize_t written = write(http_engine.wake_fd, &one, sizeof(one));
+    (void) written;
+}
+
+// makes the engine wake up for the connection once its socket is ready for 'events'
+void watch_connection(HttpEngine *engine, Connection *connection, const uint32_t events)
+{
+    // the ring is asked for what the connection waits on, along with sending whatever openssl wrote meanwhile
+    if (engine->uring) {
+        connection->watched_events = events;
+        if (!connection->connected) {
+            if (!connection->connecting) submit_uring_connect(connection);
+            return;
+        }
+
+        // openssl never has to wait to write into memory, so output that waits for the socket to be writable goes out right away 
+        if ((events & EPOLLOUT) && (flush_connection_output(connection) < 0)) {
+            shutdown(connection->sockfd, SHUT_RDWR);
+        }
+
+        submit_uring_output(connection);
+        if (events & EPOLLIN) submit_uring_input(connection);
+        return;
+    }
+
+    if (connection->watched_events == events) {
+        return;
+    }
+
+    struct epoll_event event = { .events = events, .data.ptr = connection };
+    const int op = connection->watched_events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (epoll_ctl(engine->epoll_fd, op, connection->sockfd, &event) != 0) {
+        printf("watch_connection: epoll_ctl failed\n");
+    }
+
+    connection->watched_events = events;
+}
+
+void unwatch_connection(HttpEngine *engine, Connection *connection)
+{
+    if (engine->uring) {
+        connection->watched_events = 0;
+        return;
+    }
+
+    if (connection->watched_events) {
+        epoll_ctl(engine->epoll_fd, EPOLL_CTL_DEL, connection->sockfd, NULL);
+        connection->watched_events = 0;
+    }
+}
+
+// waits for the socket if the failed tls call only needs it to become readable or writable 
+bool wait_for_tls(HttpEngine *engine, HTTP_Task *task, const int result)
+{
+    switch (SSL_get_error(task->connection->ssl, result)) {
+        case SSL_ERROR_WANT_READ:
+            watch_connection(engine, task->connection, EPOLLIN);
+            return true;
+        case SSL_ERROR_WANT_WRITE:
+            watch_connection(engine, task->connection, EPOLLOUT);
+            return true;
+        default:
+            return false;
+    }
+}
+
+// the host's protocol is known (or can't be learned) once the probing connection is handshaked or dropped
+void end_protocol_probe(HttpEngine *engine, HTTP_Task *task)
+{
+    if (!task->probing_protocol) return;
+    task->probing_protocol = false;
+
+    HostState *host_state = find_host_state(engine, task->request.host, task->request.port);
+    if (host_state) host_state->probing_protocol = false;
+}
+
+void add_active_task(HttpEngine *engine, HTTP_Task *task)
+{
+    task->prev = NULL;
+    task->next = engine->active;
+    if (engine->active) engine->active->prev = task;
+    engine->active = task;
+}
+
+void remove_active_task(HttpEngine *engine, HTTP_Task *task)
+{
+    if (task->prev) task->prev->next = task->next;
+    else engine->active = task->next;
+    if (task->next) task->next->prev = task->prev;
+    task->prev = task->next = NULL;
+}
+
+void queue_waiting_task(HttpEngine *engine, HTTP_Task *task)
+{
+    uncount_limited_task(engine, task, -1, false);
+    task->state = TASK_WAITING;
+    task->started_at = 0;
+    task->next = NULL;
+    if (engine->waiting_tail) engine->waiting_tail->next = task;
+    else engine->waiting_head = task;
+    engine->waiting_tail = task;
+}
+
+// writes the request right behind those already on the connection of 'head', its response arrives after theirs
+void attach_to_pipeline(HttpEngine *engine, HTTP_Task *head, HTTP_Task *task)
+{
+    task->state = TASK_PIPELINED;
+    task->pipeline_next = NULL;
+    head->pipeline_tail->pipeline_next = task;
+    head->pipeline_tail = task;
+    head->pipeline_depth++;
+
+    // requests attached while the head is still connecting are written once it can send (see begin_sending)
+    if ((head->state == TASK_SENDING) || (head->state == TASK_RECEIVING)) {
+        write_data_to_buffer(&head->connection->output, task->out, task->out_len);
+        task->sent_at = get_monotonic_time();
+        watch_connection(engine, head->connection, head->connection->watched_events | EPOLLOUT);
+    }
+}
+
+// queues the request of the task, and of those pipelined behind it, for writing to its connection
+void begin_sending(HTTP_Task *task)
+{
+    const double now = get_monotonic_time();
+    for (HTTP_Task *current = task; current; current = current->pipeline_next) {
+        write_data_to_buffer(&task->connection->output, current->out, current->out_len);
+        current->sent_at = now;
+    }
+    task->state = TASK_SENDING;
+}
+
+// the next request of the pipeline takes over the connection and the slot once the response to 'task' is complete
+HTTP_Task* pass_pipeline(HttpEngine *engine, HTTP_Task *task, HostState *host_state)
+{
+    HTTP_Task *next = task->pipeline_next;
+    Connection *connection = task->connection;
+
+    next->pipeline_tail = task->pipeline_tail;
+    next->pipeline_depth = task->pipeline_depth - 1;
+    if (host_state && (host_state->pipeline == task)) host_state->pipeline = next;
+
+    // the task holds neither a slot nor a connection anymore
+    remove_active_task(engine, task);
+    task->state = TASK_WAITING;
+    task->connection = NULL;
+    task->pipeline_next = NULL;
+    task->pipeline_tail = task;
+    task->pipeline_depth = 1;
+
+    add_active_task(engine, next);
+    next->state = TASK_RECEIVING;
+    next->connection = connection;
+    connection->task = next;
+    connection->reused = true;
+
+    return next;
+}
+
+// the requests pipelined behind the task go back to the waiting list when its connection can't carry them,
+// a host that closed the connection early gets no more pipelined requests
+void release_pipeline(HttpEngine *engine, HTTP_Task *task, HostState *host_state, const bool closed_early)
+{
+    if (host_state && (host_state->pipeline == task)) host_state->pipeline = NULL;
+
+    HTTP_Task *pipelined = task->pipeline_next;
+    task->pipeline_next = NULL;
+    task->pipeline_tail = task;
+    task->pipeline_depth = 1;
+    if (!pipelined) return;
+
+    if (closed_early && host_state && !host_state->pipelining_broken) {
+        printf("release_pipeline: %s closed a pipelined connection early, requests to it get a connection each\n", task->request.host);
+        host_state->pipelining_broken = true;
+    }
+
+    while (pipelined) {
+        HTTP_Task *next = pipelined->pipeline_next;
+        pipelined->pipeline_next = NULL;
+        pipelined->pipeline_tail = pipelined;
+        pipelined->pipeline_depth = 1;
+
+        // its callback already ran (see abandon_http_task)
+        if (!pipelined->callback) {
+            uncount_limited_task(engine, pipelined, -1, false);
+            free_buffer(&pipelined->response);
+            free(pipelined);
+        }
+        else queue_waiting_task(engine, pipelined);
+
+        pipelined = next;
+    }
+}
+
+// a pipelined request can't be taken back without breaking the order of the responses on its connection,
+// so its callback gets the failure right away and the response is discarded once it arrives
+void abandon_http_task(HTTP_Task *task, const double now)
+{
+    task->callback(init_buffer(), task->user_data);
+    task->callback = NULL;
+    task->request.timings = NULL;
+    task->deadline = now + DEFAULT_REQUEST_TIMEOUT;
+}
+
+#define INFLATE_CHUNK 65536
+#define MAX_PRESIZED_BODY (64 * 1024 * 1024) // a larger Content-Length isn't trusted to allocate up front
+
+// picks how the body is stored from the Content-Encoding of the response, -1 if it can't be decoded
+// the response is sized for the whole body up front when the header tells its length
+int begin_body_decoding(HTTP_Task *task)
+{
+    // an extracted object is only a part of the body
+    char length[32];
+    const size_t content_length = (!task->request.extract_object && http_header_value(task->http_response.header, "Content-Length", sizeof(length), length)) ? 
+                                  strtoull(length, NULL, 10) : 0;
+
+    char encoding[64];
+    if (!http_header_value(task->http_response.header, "Content-Encoding", sizeof(encoding), encoding) || (strcasecmp(encoding, "identity") == 0)) {
+        task->body_coding = BODY_IDENTITY;
+        if ((content_length > 0) && (content_length <= MAX_PRESIZED_BODY)) reserve_buffer(&task->response, content_length);
+        return 0;
+    }
+
+    // compressed bodies grow to several times their length
+    if ((content_length > 0) && (content_length <= MAX_PRESIZED_BODY / 4)) reserve_buffer(&task->response, content_length * 4);
+
+    if ((strcasecmp(encoding, "gzip") != 0) && (strcasecmp(encoding, "x-gzip") != 0) && (strcasecmp(encoding, "deflate") != 0)) {
+        printf("begin_body_decoding: unsupported content encoding \"%s\" from %s\n", encoding, task->request.host);
+        return -1;
+    }
+
+    // the extra 32 window bits let zlib detect whether the stream has a gzip or a zlib header
+    memset(&task->inflater, 0, sizeof(task->inflater));
+    if (inflateInit2(&task->inflater, MAX_WBITS + 32) != Z_OK) {
+        printf("begin_body_decoding: inflateInit2 failed\n");
+        return -1;
+    }
+
+    task->body_coding = BODY_INFLATING;
+    return 0;
+}
+
+// stores received body bytes in the response, compressed bodies are inflated straight into the tail of the buffer
+// so the compressed bytes are never kept around, -1 if the body is corrupt
+// a compressed body is only complete if its stream ended
+bool end_body_decoding(HTTP_Task *task)
+{
+    if ((task->body_coding != BODY_INFLATING) && (task->body_coding != BODY_INFLATED)) {
+        return true;
+    }
+
+    inflateEnd(&task->inflater);
+    const bool complete = (task->body_coding == BODY_INFLATED);
+    task->body_coding = BODY_IDENTITY;
+
+    return complete;
+}
+
+// defined with the rest of the retries and circuit breaker, further down
+bool transient_http_status(const int status_code);
+void record_host_outcome(HttpEngine *engine, HostState *host_state, const bool failed, const double now);
+
+// what a request that reached its host tells about it, its timings, a token of retry budget and the host's circuit
+void record_http_task_outcome(HttpEngine *engine, HTTP_Task *task, HostState *host_state, const bool failed, const double now)
+{
+    task->timings.finished = now;
+    task->timings.bytes_sent = task->out_len;
+    task->timings.bytes_received = task->http_response.header_len + task->response.size;
+    if (!task->request.warm_up) record_request_timings(&host_state->timings, &task->timings, failed);
+
+    if (task->retries == 0) host_state->retry_tokens = fmin(RETRY_BUDGET_BURST, host_state->retry_tokens + RETRY_BUDGET_RATIO);
+    record_host_outcome(engine, host_state, failed, now);
+}
+
+// hands the extracted object over as soon as it closed, the rest of the body is drained like that of an abandoned task
+void deliver_extracted_object(HttpEngine *engine, HTTP_Task *task)
+{
+    const double now = get_monotonic_time();
+    end_body_decoding(task);
+
+    if (task->request.cacheable) {
+        store_cached_response(&response_cache, task->request.host, task->request.path, task->http_response.header, &task->response);
+    }
+
+    // finish_http_task won't see the callback anymore, the host hears of the request now
+    HostState *host_state = find_host_state(engine, task->request.host, task->request.port);
+    if (host_state && !token_cancelled(task->request.cancel) && !engine->stopping) {
+        record_http_task_outcome(engine, task, host_state, false, now);
+    }
+
+    if (task->request.timings) {
+        *task->request.timings = task->timings;
+        task->request.timings->finished = now;
+        task->request.timings->bytes_sent = task->out_len;
+        task->request.timings->bytes_received = task->http_response.header_len + task->response.size;
+    }
+
+    Buffer response = task->response;
+    task->response = init_buffer();
+    task->callback(response, task->user_data);
+    task->callback = NULL;
+    task->request.timings = NULL;
+    task->deadline = now + DEFAULT_REQUEST_TIMEOUT;
+}
+
+// only the bytes of the extracted object stay of those appended to the response at 'from'
+void extract_response_object(HttpEngine *engine, HTTP_Task *task, const size_t from)
+{
+    // the body of an error isn't the page, it fails (or is retried) once it ended
+    if (!task->request.extract_object || !task->callback || (task->http_response.status_code != 200)) return;
+    if (extract_json_object(&task->extractor, &task->response, from)) deliver_extracted_object(engine, task);
+}
+
+int append_response_body(HttpEngine *engine, HTTP_Task *task, const char *data, const size_t n)
+{
+    // what follows an extracted object isn't kept, or even inflated
+    if (task->request.extract_object && task->extractor.done) {
+        return 0;
+    }
+
+    if ((task->body_coding == BODY_UNDECIDED) && (begin_body_decoding(task) != 0)) {
+        return -1;
+    }
+
+    if (task->body_coding == BODY_IDENTITY) {
+        const size_t from = task->response.size;
+        write_data_to_buffer(&task->response, data, n);
+        extract_response_object(engine, task, from);
+        return 0;
+    }
+
+    // anything after the end of the compressed stream is ignored
+    if (task->body_coding == BODY_INFLATED) {
+        return 0;
+    }
+
+    Buffer *response = &task->response;
+    z_stream *stream = &task->inflater;
+    stream->next_in = (Bytef*) data;
+    stream->avail_in = n;
+
+    do {
+        if (reserve_buffer(response, INFLATE_CHUNK) != 0) {
+            return -1;
+        }
+        
+        const size_t space = response->capacity - response->size;
+        stream->next_out = (Bytef*) &response->data[response->size];
+        stream->avail_out = space;
+
+        const size_t from = response->size;
+        const int status = inflate(stream, Z_NO_FLUSH);
+        response->size += space - stream->avail_out;
+        response->data[response->size] = '\0';
+
+        // every chunk is trimmed right away, so the buffer never holds much more than the object
+        extract_response_object(engine, task, from);
+        if (task->request.extract_object && task->extractor.done) {
+            return 0;
+        }
+        
+        if (status == Z_STREAM_END) {
+            task->body_coding = BODY_INFLATED;
+            break;
+        }
+
+        if ((status != Z_OK) && (status != Z_BUF_ERROR)) {
+            printf("append_response_body: inflate failed for %s%s (%s)\n", task->request.host, task->request.path, stream->msg ? stream->msg : "unknown error");
+            return -1;
+        }
+    } while ((stream->avail_in > 0) || (stream->avail_out == 0));
+
+    return 0;
+}
+
+
+// other events of the current epoll_wait may still point at a connection, so it is closed after they are handled
+void retire_connection(HttpEngine *engine, Connection *connection)
+{
+    unwatch_connection(engine, connection);
+    connection->task = NULL;
+    connection->next = engine->retired_connections;
+    engine->retired_connections = connection;
+}
+
+void close_retired_connections(HttpEngine *engine)
+{
+    while (engine->retired_connections) {
+        Connection *to_close = engine->retired_connections;
+        engine->retired_connections = to_close->next;
+        close_connection(to_close);
+    }
+}
+
+// closes every connect attempt of the task except 'winner'
+void retire_connect_attempts(HttpEngine *engine, HTTP_Task *task, Connection *winner)
+{
+    for (size_t i = 0; i < task->attempt_count; i++) {
+        if (task->attempts[i] != winner) retire_connection(engine, task->attempts[i]);
+    }
+    task->attempt_count = 0;
+}
+
+// a response that asks for the request to be tried again later
+bool transient_http_status(const int status_code)
+{
+    return (status_code == 429) || (status_code >= 500);
+}
+
+// can be called from any thread
+size_t count_open_circuits(HttpEngine *engine)
+{
+    return __atomic_load_n(&engine->open_circuits, __ATOMIC_ACQUIRE);
+}
+
+// every request that reached its host moves the host's circuit, the outcome of a probe decides whether it closes again
+void record_host_outcome(HttpEngine *engine, HostState *host_state, const bool failed, const double now)
+{
+    // requests that were in flight when the circuit opened
+    if (host_state->circuit == CIRCUIT_OPEN) return;
+
+    if (!failed) {
+        if (host_state->circuit == CIRCUIT_HALF_OPEN) {
+            printf("record_host_outcome: %s answers again, its circuit is closed\n", host_state->host);
+            host_state->circuit = CIRCUIT_CLOSED;
+            host_state->circuit_open_time = CIRCUIT_OPEN_TIME;
+            __atomic_sub_fetch(&engine->open_circuits, 1, __ATOMIC_ACQ_REL);
+        }
+        host_state->consecutive_failures = 0;
+        return;
+    }
+
+    if (host_state->circuit == CIRCUIT_CLOSED) {
+        if (++host_state->consecutive_failures < CIRCUIT_FAILURE_THRESHOLD) return;
+        host_state->circuit_trips++;
+        __atomic_add_fetch(&engine->open_circuits, 1, __ATOMIC_ACQ_REL);
+    }
+    else host_state->circuit_open_time = fmin(host_state->circuit_open_time * 2, MAX_CIRCUIT_OPEN_TIME);
+
+    host_state->circuit = CIRCUIT_OPEN;
+    host_state->circuit_open_until = now + host_state->circuit_open_time;
+    if (host_state->circuit_open_until < engine->next_probe) engine->next_probe = host_state->circuit_open_until;
+    printf("record_host_outcome: %s keeps failing, its requests fail right away for the next %.0f s\n", host_state->host, host_state->circuit_open_time);
+}
+
+// the next request to the host is its probe, the circuit opens again if that has not answered in time
+void half_open_circuit(HttpEngine *engine, HostState *host_state, const double now)
+{
+    host_state->circuit = CIRCUIT_HALF_OPEN;
+    host_state->circuit_open_until = now + 2 * DEFAULT_REQUEST_TIMEOUT;
+    host_state->probe_sent = false;
+    if (host_state->circuit_open_until < engine->next_probe) engine->next_probe = host_state->circuit_open_until;
+}
+
+// false if the task has to fail because its host's circuit is open, once the open time is over a single request goes through as the probe
+bool circuit_allows(HttpEngine *engine, HostState *host_state, HTTP_Task *task, const double now)
+{
+    switch (host_state->circuit) {
+        case CIRCUIT_OPEN:
+            if (now < host_state->circuit_open_until) return false;
+            half_open_circuit(engine, host_state, now);
+            host_state->probe_sent = task->probe = true;
+            return true;
+        case CIRCUIT_HALF_OPEN:
+            // the probe itself comes back here while it waits for a connection or its host's concurrency
+            if (task->probe) return true;
+            if (!task->request.warm_up || host_state->probe_sent) return false;
+            host_state->probe_sent = task->probe = true;
+            return true;
+        case CIRCUIT_CLOSED:
+        default:
+            return true;
+    }
+}
+
+// puts a transiently failed task back into waiting for another attempt after a backoff, false if it is out of retries, budget or time
+bool retry_http_task(HttpEngine *engine, HTTP_Task *task, HostState *host_state, const double now)
+{
+    if ((task->retries >= MAX_RETRIES) || (host_state->circuit != CIRCUIT_CLOSED) || (host_state->retry_tokens < 1)) {
+        return false;
+    }
+
+    // full jitter over an exponentially growing window, but not sooner than the server asked for
+    const double window = fmin(MAX_RETRY_DELAY, RETRY_BASE_DELAY * (1 << task->retries));
+    double delay = window * rand_r(&engine->random_seed) / RAND_MAX;
+    char retry_after[32];
+    if (http_header_value(task->http_response.header, "Retry-After", sizeof(retry_after), retry_after)) {
+        delay = fmax(delay, atof(retry_after));
+    }
+    if (now + delay >= task->deadline) return false;
+
+    host_state->retry_tokens -= 1;
+    host_state->retries++;
+    task->retries++;
+    task->retry_at = now + delay;
+    if (task->retry_at < engine->next_retry) engine->next_retry = task->retry_at;
+    printf("retry_http_task: retrying %s%s in %.0f ms (attempt %zu)\n", task->request.host, task->request.path, delay * 1000, task->retries + 1);
+
+    // starts over like a freshly submitted task
+    task->connection = NULL;
+    task->stream_id = 0;
+    task->probing_protocol = false;
+    task->candidates.count = 0;
+    task->next_candidate = 0;
+    task->attempt_count = 0;
+    init_http_response(&task->http_response);
+    task->body_coding = BODY_UNDECIDED;
+    task->response.size = 0;
+    if (task->request.extract_object) init_object_extractor(&task->extractor, task->request.extract_object);
+    queue_waiting_task(engine, task);
+    return true;
+}
+
+// releases the task's connection and slot, then hands the response to the callback
+void finish_http_task(HttpEngine *engine, HTTP_Task *task, bool succeeded)
+{
+    Connection *connection = task->connection;
+    HostState *host_state = find_host_state(engine, task->request.host, task->request.port);
+    const double now = get_monotonic_time();
+    const bool dispatched = task->started_at > 0;
+
+    if (!end_body_decoding(task) && succeeded) {
+        printf("finish_http_task: compressed body from %s%s is truncated\n", task->request.host, task->request.path);
+        succeeded = false;
+    }
+
+    // a cancelled request says nothing about the host, and resolving, connecting and handshaking don't count toward its latency
+    const bool cancelled = token_cancelled(task->request.cancel);
+    const double latency = (cancelled || (task->sent_at == 0)) ? -1 : (now - task->sent_at);
+    uncount_limited_task(engine, task, latency, !cancelled && !succeeded);
+
+    if (task->state == TASK_STREAMING) {
+        // the connection is shared and outlives its streams
+        remove_active_task(engine, task);
+        connection->http2_streams--;
+    }
+
+    else if (task->state != TASK_WAITING) {
+        remove_active_task(engine, task);
+        retire_connect_attempts(engine, task, NULL);
+
+        if (host_state) host_state->active_connections--;
+        end_protocol_probe(engine, task);
+        release_pipeline(engine, task, host_state, succeeded && !task->http_response.keep_alive);
+
+        if (connection) {
+            unwatch_connection(engine, connection);
+            connection->task = NULL;
+            
+            const bool reusable = succeeded && task->http_response.keep_alive && (connection->read_start == connection->read_end);
+            if (reusable) 
+                return_connection(&connection_pool, connection);
+            else 
+                close_connection(connection);
+        }
+    }
+
+    // neither a request that never left the waiting list nor an abandoned one tells anything about the host
+    if (host_state && dispatched && !cancelled && task->callback && !engine->stopping) {
+        const bool failed = !succeeded || transient_http_status(task->http_response.status_code);
+        record_http_task_outcome(engine, task, host_state, failed, now);
+        if (failed && !task->request.warm_up && retry_http_task(engine, task, host_state, now)) return;
+    }
+
+    if (succeeded && task->request.cacheable) {
+        const HTTP_Response *response = &task->http_response;
+        if (response->status_code == 304) {
+            succeeded = revalidate_cached_response(&response_cache, task->request.host, task->request.path, response->header, &task->response);
+            if (!succeeded) printf("finish_http_task: %s%s was not modified but is no longer cached\n", task->request.host, task->request.path);
+        }
+        // an extracted object was stored once it closed (see deliver_extracted_object)
+        else if ((response->status_code == 200) && !task->request.extract_object) {
+            store_cached_response(&response_cache, task->request.host, task->request.path, response->header, &task->response);
+        }
+    }
+
+    // an abandoned task only drained its response from the connection
+    if (!task->callback) {
+        free_buffer(&task->response);
+        free(task);
+        return;
+    }
+
+    // the body ended before the object closed, a 304 brought the cached object instead
+    if (succeeded && task->request.extract_object && !task->extractor.done && (task->http_response.status_code != 304)) {
+        printf("finish_http_task: no complete \"%s\" in %s%s\n", task->request.extract_object, task->request.host, task->request.path);
+        succeeded = false;
+    }
+
+    if (!succeeded) {
+        if (task->request.warm_up) printf("finish_http_task: could not warm up a connection to %s\n", task->request.host);
+        else printf("finish_http_task: request to %s%s failed\n", task->request.host, task->request.path);
+        free_buffer(&task->response);
+    }
+
+    if (task->request.timings) {
+        *task->request.timings = task->timings;
+        task->request.timings->finished = now;
+    }
+
+    task->callback(task->response, task->user_data);
+    free(task);
+}
+
+// starts a connect to the next candidate address of the task, false if there is none left
+bool start_connect_attempt(HttpEngine *engine, HTTP_Task *task)
+{
+    while (task->next_candidate < task->candidates.count) {
+        const size_t i = task->next_candidate++;
+        Connection *attempt = open_connection(task->request.host, task->request.port, &task->candidates.addresses[i], task->candidates.address_lens[i], task->request.allow_http2);
+        if (!attempt) continue;
+
+        attempt->task = task;
+        task->attempts[task->attempt_count++] = attempt;
+        watch_connection(engine, attempt, EPOLLOUT);
+
+        task->next_attempt_at = happy_eyeballs ? (get_monotonic_time() + CONNECT_ATTEMPT_DELAY) : INFINITY;
+        if (task->next_attempt_at < engine->next_connect_attempt) {
+            engine->next_connect_attempt = task->next_attempt_at;
+        }
+        return true;
+    }
+
+    return false;
+}
+
+void record_connect_time(HttpEngine *engine, const double seconds)
+{
+    engine->connect_times[engine->connect_count % CONNECT_TIME_SAMPLES] = seconds;
+    engine->connect_count++;
+}
+
+int compare_doubles(const void *a, const void *b)
+{
+    const double x = *(const double*) a;
+    const double y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+// expects the engine thread to be stopped
+void print_connect_time_stats(HttpEngine *engine)
+{
+    const size_t count = (engine->connect_count < CONNECT_TIME_SAMPLES) ? engine->connect_count : CONNECT_TIME_SAMPLES;
+    if (count == 0) {
+        printf("connect times: no connections were opened\n");
+        return;
+    }
+
+    double sorted[CONNECT_TIME_SAMPLES];
+    memcpy(sorted, engine->connect_times, count * sizeof(double));
+    qsort(sorted, count, sizeof(double), compare_doubles);
+
+    printf("connect times (%s, %zu samples): p50 %.1f ms, p90 %.1f ms, p99 %.1f ms, max %.1f ms\n", 
+            happy_eyeballs ? "happy eyeballs" : "sequential", count, 
+            sorted[count / 2] * 1000, sorted[(count * 9) / 10] * 1000, sorted[(count * 99) / 100] * 1000, sorted[count - 1] * 1000);
+}
+
+// opens a new connection for the task once the address of its host is known
+void connect_http_task(HttpEngine *engine, HTTP_Task *task)
+{
+    task->state = TASK_CONNECTING;
+    task->connection = NULL;
+
+    switch (lookup_dns(&dns_cache, task->request.host, task->request.port, &task->candidates)) {
+        case DNS_HIT:
+            task->timings.resolved = get_monotonic_time();
+            break;
+        case DNS_PENDING:
+            task->state = TASK_RESOLVING;
+            return;
+        case DNS_FAILED:
+        default:
+            printf("connect_http_task: could not resolve %s\n", task->request.host);
+            finish_http_task(engine, task, false);
+            return;
+    }
+
+    task->next_candidate = 0;
+    task->attempt_count = 0;
+    task->connect_started = get_monotonic_time();
+    if (!start_connect_attempt(engine, task)) {
+        finish_http_task(engine, task, false);
+    }
+}
+
+// the server may have closed an idle connection just before our request arrived, 
+// in that case the request is tried once more on a fresh connection
+void fail_http_task(HttpEngine *engine, HTTP_Task *task)
+{
+    Connection *connection = task->connection;
+    const bool nothing_received = (task->http_response.state == PARSING_STATUS_LINE);
+    const bool closed_early = (task->state == TASK_SENDING) || (task->state == TASK_RECEIVING);
+    release_pipeline(engine, task, find_host_state(engine, task->request.host, task->request.port), closed_early);
+
+    if (!connection || !connection->reused || !nothing_received || task->retried) {
+        finish_http_task(engine, task, false);
+        return;
+    }
+
+    unwatch_connection(engine, connection);
+    close_connection(connection);
+
+    task->retried = true;
+    connect_http_task(engine, task);
+}
+
+// a request that was sent on a broken connection but never answered goes back to the waiting list once
+void retry_or_fail_http_task(HttpEngine *engine, HTTP_Task *task)
+{
+    if (task->retried || (task->http_response.status_code != 0)) {
+        finish_http_task(engine, task, false);
+        return;
+    }
+
+    if (task->state == TASK_STREAMING) {
+        task->connection->http2_streams--;
+    }
+
+    remove_active_task(engine, task);
+    task->retried = true;
+    task->stream_id = 0;
+    task->connection = NULL;
+    queue_waiting_task(engine, task);
+}
+
+#define DEADLINE_CHECK_INTERVAL 0.25 // seconds
+
+bool http_task_expired(const HTTP_Task *task, const double now)
+{
+    // an abandoned task only has to drain its response in time
+    if (!task->callback) return now >= task->deadline;
+    return (now >= task->deadline) || token_cancelled(task->request.cancel);
+}
+
+void print_expired_http_task(const HTTP_Task *task)
+{
+    const char *reason = token_cancelled(task->request.cancel) ? "was cancelled" : "timed out";
+    printf("expire_http_tasks: request to %s%s %s\n", task->request.host, task->request.path, reason);
+}
+
+int on_http2_header(nghttp2_session *session, const nghttp2_frame *frame, const uint8_t *name, size_t namelen, const uint8_t *value, size_t valuelen, uint8_t flags, void *user_data)
+{
+    HTTP_Task *task = nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
+    if (!task) return 0;
+
+    HTTP_Response *response = &task->http_response;
+    char line[4096];
+    
+    // the header is kept in http/1.1 form, starting with a status line, so that it can be searched the same way
+    if ((namelen == 7) && (memcmp(name, ":status", 7) == 0)) {
+        const int len = snprintf(line, sizeof(line), "HTTP/2 %.*s", (int) valuelen, value);
+        response->status_code = atoi(&line[7]);
+        response->header_len = 0;
+        task->timings.first_byte = get_monotonic_time();
+        append_response_header_line(response, line, len);
+        response->state = PARSING_HEADERS;
+    }
+
+    else if ((namelen > 0) && (name[0] != ':')) {
+        const int len = snprintf(line, sizeof(line), "%.*s: %.*s", (int) namelen, name, (int) valuelen, value);
+        append_response_header_line(response, line, (len < (int) sizeof(line)) ? len : (sizeof(line) - 1));
+    }
+
+    return 0;
+}
+
+int on_http2_data_chunk(nghttp2_session *session, uint8_t flags, int32_t stream_id, const uint8_t *data, size_t len, void *user_data)
+{
+    HttpEngine *engine = (HttpEngine*) user_data;
+    HTTP_Task *task = nghttp2_session_get_stream_user_data(session, stream_id);
+    if (!task) return 0;
+
+    // a busy connection can keep the engine reading for a while, cancelled streams shouldn't wait for the next deadline check
+    if (token_cancelled(task->request.cancel)) {
+        print_expired_http_task(task);
+        nghttp2_session_set_stream_user_data(session, stream_id, NULL);
+        nghttp2_submit_rst_stream(session, NGHTTP2_FLAG_NONE, stream_id, NGHTTP2_CANCEL);
+        finish_http_task(engine, task, false);
+    }
+
+    else if (append_response_body(engine, task, (const char*) data, len) != 0) {
+        nghttp2_submit_rst_stream(session, NGHTTP2_FLAG_NONE, stream_id, NGHTTP2_INTERNAL_ERROR);
+    }
+    
+    return 0;
+}
+
+int on_http2_stream_close(nghttp2_session *session, int32_t stream_id, uint32_t error_code, void *user_data)
+{
+    HttpEngine *engine = (HttpEngine*) user_data;
+    HTTP_Task *task = nghttp2_session_get_stream_user_data(session, stream_id);
+    if (!task) return 0;
+
+    nghttp2_session_set_stream_user_data(session, stream_id, NULL);
+    
+    if (error_code == NGHTTP2_NO_ERROR) 
+        finish_http_task(engine, task, task->http_response.status_code != 0);
+    else if (error_code == NGHTTP2_REFUSED_STREAM) 
+        retry_or_fail_http_task(engine, task);
+    else 
+        finish_http_task(engine, task, false);
+
+    return 0;
+}
+
+int init_http2_session(HttpEngine *engine, Connection *connection)
+{
+    nghttp2_session_callbacks *callbacks;
+    if (nghttp2_session_callbacks_new(&callbacks) != 0) {
+        printf("init_http2_session: nghttp2_session_callbacks_new failed\n");
+        return -1;
+    }
+
+    nghttp2_session_callbacks_set_on_header_callback(callbacks, on_http2_header);
+    nghttp2_session_callbacks_set_on_data_chunk_recv_callback(callbacks, on_http2_data_chunk);
+    nghttp2_session_callbacks_set_on_stream_close_callback(callbacks, on_http2_stream_close);
+
+    const int status = nghttp2_session_client_new(&connection->http2, callbacks, engine);
+    nghttp2_session_callbacks_del(callbacks);
+    if (status != 0) {
+        printf("init_http2_session: nghttp2_session_client_new failed\n");
+        connection->http2 = NULL;
+        return -1;
+    }
+
+    // thumbnails are small, a larger stream window lets a whole image arrive without waiting for window updates
+    const nghttp2_settings_entry settings[] = {
+        { NGHTTP2_SETTINGS_ENABLE_PUSH, 0 },
+        { NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE, 1 << 20 },
+    };
+
+    if (nghttp2_submit_settings(connection->http2, NGHTTP2_FLAG_NONE, settings, sizeof(settings) / sizeof(settings[0])) != 0) {
+        printf("init_http2_session: nghttp2_submit_settings failed\n");
+        return -1;
+    }
+
+    // the connection window is shared by every stream, so it grows with them
+    if (nghttp2_session_set_local_window_size(connection->http2, NGHTTP2_FLAG_NONE, 0, 16 << 20) != 0) {
+        printf("init_http2_session: nghttp2_session_set_local_window_size failed\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+// fails or requeues every stream of a http/2 connection that can't be used anymore, then closes it
+void close_http2_connection(HttpEngine *engine, Connection *connection)
+{
+    HostState *host_state = find_host_state(engine, connection->host, connection->port);
+    if (host_state && (host_state->http2_connection == connection)) {
+        host_state->http2_connection = NULL;
+        host_state->active_connections--;
+    }
+
+    unwatch_connection(engine, connection);
+
+    HTTP_Task *task = engine->active;
+    while (task) {
+        HTTP_Task *next = task->next;
+        if ((task->state == TASK_STREAMING) && (task->connection == connection)) {
+            nghttp2_session_set_stream_user_data(connection->http2, task->stream_id, NULL);
+            retry_or_fail_http_task(engine, task);
+        }
+        task = next;
+    }
+
+    close_connection(connection);
+}
+
+// exchanges as many frames with the server as the socket allows without blocking
+void advance_http2_connection(HttpEngine *engine, Connection *connection)
+{
+    nghttp2_session *session = connection->http2;
+    connection->wants_write = false;
+
+    while (true) {
+        ERR_clear_error();
+        const int read = SSL_read(connection->ssl, connection->read_buffer, sizeof(connection->read_buffer));
+        if (read > 0) {
+            connection->last_received = get_monotonic_time();
+            const ssize_t processed = nghttp2_session_mem_recv(session, (const uint8_t*) connection->read_buffer, read);
+            if (processed < 0) {
+                printf("advance_http2_connection: nghttp2_session_mem_recv failed (%s)\n", nghttp2_strerror(processed));
+                close_http2_connection(engine, connection);
+                return;
+            }
+            continue;
+        }
+
+        const int error = SSL_get_error(connection->ssl, read);
+        if (error == SSL_ERROR_WANT_READ) break;
+        if (error == SSL_ERROR_WANT_WRITE) {
+            connection->wants_write = true;
+            break;
+        }
+
+        // the server closed the connection
+        close_http2_connection(engine, connection);
+        return;
+    }
+
+    while (true) {
+        const uint8_t *frames;
+        const ssize_t n = nghttp2_session_mem_send(session, &frames);
+        if (n < 0) {
+            printf("advance_http2_connection: nghttp2_session_mem_send failed (%s)\n", nghttp2_strerror(n));
+            close_http2_connection(engine, connection);
+            return;
+        }
+
+        if (n == 0) break;
+        write_data_to_buffer(&connection->output, (const char*) frames, n);
+    }
+
+    if (flush_connection_output(connection) < 0) {
+        close_http2_connection(engine, connection);
+        return;
+    }
+
+    // the session ends after a GOAWAY once every stream is done
+    if (!nghttp2_session_want_read(session) && !nghttp2_session_want_write(session) && (connection->output.size == 0)) {
+        close_http2_connection(engine, connection);
+        return;
+    }
+
+    watch_connection(engine, connection, connection->wants_write ? (EPOLLIN | EPOLLOUT) : EPOLLIN);
+}
+
+#define MAKE_NV(NAME, VALUE, VALUE_LEN) \
+    (nghttp2_nv) { (uint8_t*) (NAME), (uint8_t*) (VALUE), strlen(NAME), (VALUE_LEN), NGHTTP2_NV_FLAG_NONE }
+
+// sends the task as a new stream of the host's http/2 connection, 
+// the request line and fields of the http/1.1 header are translated into http/2 pseudo and regular headers
+void start_http2_stream(HttpEngine *engine, Connection *connection, HTTP_Task *task)
+{
+    nghttp2_nv nva[32];
+    size_t nvlen = 0;
+
+    char header[sizeof(task->request.header)];
+    snprintf(header, sizeof(header), "%s", task->request.header);
+
+    char *method = header;
+    char *line_end = strstr(header, "\r\n");
+    char *method_end = strchr(header, ' ');
+    if (!line_end || !method_end) {
+        printf("start_http2_stream: malformed request line\n");
+        add_active_task(engine, task);
+        task->state = TASK_CONNECTING;
+        finish_http_task(engine, task, false);
+        return;
+    }
+
+    *method_end = '\0';
+    nva[nvlen++] = MAKE_NV(":method", method, strlen(method));
+    nva[nvlen++] = MAKE_NV(":scheme", "https", 5);
+    nva[nvlen++] = MAKE_NV(":authority", task->request.host, strlen(task->request.host));
+    nva[nvlen++] = MAKE_NV(":path", task->request.path, strlen(task->request.path));
+
+    char *field = line_end + 2;
+    while ((line_end = strstr(field, "\r\n")) && (line_end != field) && (nvlen < (sizeof(nva) / sizeof(nva[0])))) {
+        *line_end = '\0';
+        char *colon = strchr(field, ':');
+        if (colon) {
+            *colon = '\0';
+            char *value = colon + 1;
+            while (*value == ' ') value++;
+
+            // field names are lowercase in http/2, connection specific fields are not allowed 
+            for (char *c = field; *c; c++) *c = tolower((unsigned char)*c);
+            const bool connection_specific = (strcmp(field, "host") == 0) || (strcmp(field, "connection") == 0) || (strcmp(field, "keep-alive") == 0) || (strcmp(field, "transfer-encoding") == 0) || (strcmp(field, "upgrade") == 0);
+            if (!connection_specific) {
+                nva[nvlen++] = MAKE_NV(field, value, strlen(value));
+            }
+        }
+
+        field = line_end + 2;
+    }
+
+    add_active_task(engine, task);
+    task->state = TASK_STREAMING;
+    task->connection = connection;
+    connection->http2_streams++;
+
+    task->stream_id = nghttp2_submit_request(connection->http2, NULL, nva, nvlen, NULL, task);
+    task->sent_at = get_monotonic_time();
+    if (task->stream_id < 0) {
+        printf("start_http2_stream: nghttp2_submit_request failed (%s)\n", nghttp2_strerror(task->stream_id));
+        finish_http_task(engine, task, false);
+    }
+}
+
+// once the handshake of a connection opened for a request that allows http/2 is done,
+// the negotiated protocol decides whether the connection is shared by all such requests to the host
+bool begin_http2_connection(HttpEngine *engine, HTTP_Task *task)
+{
+    Connection *connection = task->connection;
+    end_protocol_probe(engine, task);
+
+    const unsigned char *alpn = NULL;
+    unsigned int alpn_len = 0;
+    SSL_get0_alpn_selected(connection->ssl, &alpn, &alpn_len);
+    const bool http2 = (alpn_len == 2) && (memcmp(alpn, "h2", 2) == 0);
+
+    HostState *host_state = find_host_state(engine, connection->host, connection->port);
+    if (host_state) host_state->protocol = http2 ? PROTOCOL_HTTP2 : PROTOCOL_HTTP1;
+    if (!http2) return false;
+
+    // requests pipelined behind the task become streams as well
+    release_pipeline(engine, task, host_state, false);
+
+    // another connection became the host's http/2 session first, the task joins it as a stream and this one is closed
+    if (host_state && host_state->http2_connection) {
+        remove_active_task(engine, task);
+        host_state->active_connections--;
+        retire_connection(engine, connection);
+        task->connection = NULL;
+
+        if (task->request.warm_up) {
+            task->state = TASK_WAITING;
+            finish_http_task(engine, task, true);
+        }
+        else queue_waiting_task(engine, task);
+        return true;
+    }
+
+    if (!host_state || (init_http2_session(engine, connection) != 0)) {
+        printf("begin_http2_connection: could not use http/2 connection to %s\n", connection->host);
+        finish_http_task(engine, task, false);
+        return true;
+    }
+
+    // the slot of the request now belongs to the connection
+    host_state->http2_connection = connection;
+    connection->task = NULL;
+    remove_active_task(engine, task);
+
+    if (task->request.warm_up) {
+        // the task holds neither a slot nor a connection anymore
+        task->state = TASK_WAITING;
+        task->connection = NULL;
+        finish_http_task(engine, task, true);
+    }
+    else start_http2_stream(engine, connection, task);
+    
+    advance_http2_connection(engine, connection);
+    return true;
+}
+
+// moves the task as far as its socket allows without blocking
+void advance_http_task(HttpEngine *engine, HTTP_Task *task)
+{
+    Connection *connection = task->connection;
+
+    while (true) {
+        switch (task->state) {
+            case TASK_HANDSHAKING: {
+                ERR_clear_error();
+                const int result = SSL_connect(connection->ssl);
+                if (result != 1) {
+                    if (!wait_for_tls(engine, task, result)) {
+                        printf("advance_http_task: SSL_connect to %s failed\n", connection->host);
+                        fail_http_task(engine, task);
+                    }
+                    return;
+                }
+
+                if (kernel_tls) connection->kernel_tls = BIO_get_ktls_recv(SSL_get_rbio(connection->ssl));
+
+                count_tls_handshake(&tls_session_cache, SSL_session_reused(connection->ssl), connection->kernel_tls);
+                task->timings.handshaken = get_monotonic_time();
+                if (task->request.allow_http2 && begin_http2_connection(engine, task)) {
+                    return;
+                }
+
+                // the connection goes to the pool
+                if (task->request.warm_up) {
+                    task->http_response.keep_alive = true;
+                    finish_http_task(engine, task, true);
+                    return;
+                }
+
+                begin_sending(task);
+                break;
+            }
+
+            case TASK_SENDING: {
+                connection->wants_write = false;
+                const int flushed = flush_connection_output(connection);
+                if (flushed < 0) {
+                    fail_http_task(engine, task);
+                    return;
+                }
+
+                if (flushed == 0) {
+                    watch_connection(engine, connection, connection->wants_write ? EPOLLOUT : EPOLLIN);
+                    return;
+                }
+
+                task->state = TASK_RECEIVING;
+                break;
+            }
+
+            case TASK_RECEIVING: {
+                // requests pipelined behind this one may still be waiting to be written
+                if ((connection->output.size > 0) && (flush_connection_output(connection) < 0)) {
+                    fail_http_task(engine, task);
+                    return;
+                }
+
+                // once nothing else is buffered, the rest of a plain body is read straight into the response
+                HTTP_Response *response = &task->http_response;
+                if ((response->state == PARSING_BODY) && (task->body_coding == BODY_IDENTITY) && (connection->read_start == connection->read_end) && 
+                    !task->request.extract_object) {
+                    const size_t wanted = (response->remaining < INT_MAX) ? response->remaining : INT_MAX;
+                    if (reserve_buffer(&task->response, wanted) != 0) {
+                        finish_http_task(engine, task, false);
+                        return;
+                    }
+
+                    // openssl may still hold a record it read, only then it has to be asked for the data.
+                    // it also reads the records that aren't data, the kernel only decrypts them
+                    ssize_t read = KERNEL_TLS_NOT_DATA;
+                    if (connection->kernel_tls && !SSL_has_pending(connection->ssl)) {
+                        read = recv_kernel_tls(connection, &task->response.data[task->response.size], wanted);
+                        if (read == -1) {
+                            fail_http_task(engine, task);
+                            return;
+                        }
+
+                        if (read == 0) {
+                            watch_connection(engine, connection, (connection->output.size > 0) ? (EPOLLIN | EPOLLOUT) : EPOLLIN);
+                            return;
+                        }
+                    }
+
+                    if (read == KERNEL_TLS_NOT_DATA) {
+                        ERR_clear_error();
+                        read = SSL_read(connection->ssl, &task->response.data[task->response.size], wanted);
+                        if (read <= 0) {
+                            const int error = SSL_get_error(connection->ssl, read);
+                            if ((error == SSL_ERROR_WANT_READ) || (error == SSL_ERROR_WANT_WRITE)) {
+                                connection->wants_write = (error == SSL_ERROR_WANT_WRITE);
+                                const uint32_t events = connection->wants_write ? EPOLLOUT : EPOLLIN;
+                                watch_connection(engine, connection, (connection->output.size > 0) ? (events | EPOLLOUT) : events);
+                                return;
+                            }
+
+                            printf("advance_http_task: SSL_read from %s returned %d (error %d)\n", connection->host, (int) read, error);
+                            fail_http_task(engine, task);
+                            return;
+                        }
+                    }
+
+                    task->response.size += read;
+                    task->response.data[task->response.size] = '\0';
+                    response->remaining -= read;
+                    if (response->remaining == 0) response->state = PARSING_DONE;
+                    break;
+                }
+
+                const char *body;
+                size_t body_len;
+                switch (read_http_event(connection, &task->http_response, &body, &body_len)) {
+                    case HTTP_BODY_DATA:
+                        if (append_response_body(engine, task, body, body_len) != 0) {
+                            finish_http_task(engine, task, false);
+                            return;
+                        }
+                        break;
+                    case HTTP_HEADERS_READY:
+                        task->timings.first_byte = get_monotonic_time();
+                        break;
+                    case HTTP_NEED_MORE: {
+                        const uint32_t events = connection->wants_write ? EPOLLOUT : EPOLLIN;
+                        watch_connection(engine, connection, (connection->output.size > 0) ? (events | EPOLLOUT) : events);
+                        return;
+                    }
+                    case HTTP_MESSAGE_DONE:
+                        // the next response of the pipeline may already be in the read buffer
+                        if (task->pipeline_next && task->http_response.keep_alive) {
+                            HTTP_Task *next = pass_pipeline(engine, task, find_host_state(engine, task->request.host, task->request.port));
+                            finish_http_task(engine, task, true);
+                            advance_http_task(engine, next);
+                            return;
+                        }
+
+                        finish_http_task(engine, task, true);
+                        return;
+                    case HTTP_ERROR:
+                    default:
+                        fail_http_task(engine, task);
+                        return;
+                }
+                break;
+            }
+
+            default:
+                return;
+        }
+    }
+}
+
+// called once a connect attempt of the task finished, the first attempt to succeed wins the race
+void on_connect_attempt_done(HttpEngine *engine, HTTP_Task *task, Connection *attempt, const int error)
+{
+    if (error != 0) {
+        printf("on_connect_attempt_done: connect to %s failed (%s)\n", attempt->host, strerror(error));
+        report_dns_failure(&dns_cache, attempt->host, attempt->port, &attempt->address, attempt->address_len);
+
+        for (size_t i = 0; i < task->attempt_count; i++) {
+            if (task->attempts[i] == attempt) {
+                task->attempts[i] = task->attempts[--task->attempt_count];
+                break;
+            }
+        }
+        retire_connection(engine, attempt);
+
+        // a failed attempt doesn't wait for the delay before the next one starts
+        if (!start_connect_attempt(engine, task) && (task->attempt_count == 0)) {
+            fail_http_task(engine, task);
+        }
+        return;
+    }
+
+    retire_connect_attempts(engine, task, attempt);
+    record_connect_time(engine, get_monotonic_time() - task->connect_started);
+    report_dns_success(&dns_cache, attempt->host, attempt->port, &attempt->address, attempt->address_len);
+
+    task->connection = attempt;
+    task->state = TASK_HANDSHAKING;
+    task->timings.connected = get_monotonic_time();
+    advance_http_task(engine, task);
+}
+
+// starts the raced connects that are due, tasks whose attempts all failed already moved on
+void start_due_connect_attempts(HttpEngine *engine)
+{
+    const double now = get_monotonic_time();
+    engine->next_connect_attempt = INFINITY;
+
+    for (HTTP_Task *task = engine->active; task; task = task->next) {
+        if ((task->state != TASK_CONNECTING) || (task->next_candidate >= task->candidates.count)) continue;
+        
+        if (now >= task->next_attempt_at) {
+            start_connect_attempt(engine, task);
+        }
+        else if (task->next_attempt_at < engine->next_connect_attempt) {
+            engine->next_connect_attempt = task->next_attempt_at;
+        }
+    }
+}
+
+// gives the task a connection, an idle one from the pool if possible
+void start_http_task(HttpEngine *engine, HTTP_Task *task, HostState *host_state)
+{
+    add_active_task(engine, task);
+
+    task->connection = task->request.warm_up ? NULL : checkout_connection(&connection_pool, task->request.host, task->request.port);
+    if (task->connection) {
+        begin_sending(task);
+        task->connection->task = task;
+        advance_http_task(engine, task);
+        return;
+    }
+
+    // until the first handshake reveals the host's protocol, other requests that allow http/2 wait for it
+    if (task->request.allow_http2 && (host_state->protocol != PROTOCOL_HTTP1)) {
+        task->probing_protocol = true;
+        host_state->probing_protocol = true;
+    }
+
+    connect_http_task(engine, task);
+}
+
+// tasks that waited for the resolver try again, those whose host is still being resolved keep waiting
+void resume_resolving_tasks(HttpEngine *engine)
+{
+    HTTP_Task *task = engine->active;
+    while (task) {
+        HTTP_Task *next = task->next;
+        if (task->state == TASK_RESOLVING) connect_http_task(engine, task);
+        task = next;
+    }
+}
+
+// hands a fresh cached response to the callback, the task never reached the host
+void finish_cached_task(HTTP_Task *task, const double now)
+{
+    if (task->request.timings) {
+        *task->request.timings = task->timings;
+        task->request.timings->finished = now;
+        task->request.timings->bytes_received = task->response.size;
+    }
+
+    task->callback(task->response, task->user_data);
+    free(task);
+}
+
+// starts every waiting task whose host has a free connection slot or http/2 stream, in submission order
+void dispatch_waiting_tasks(HttpEngine *engine)
+{
+    const double now = get_monotonic_time();
+    HTTP_Task *waiting = engine->waiting_head;
+    engine->waiting_head = engine->waiting_tail = NULL;
+    engine->next_retry = INFINITY;
+
+    while (waiting) {
+        HTTP_Task *task = waiting;
+        waiting = waiting->next;
+        task->next = NULL;
+
+        if (task->cached) {
+            finish_cached_task(task, now);
+            continue;
+        }
+
+        HostState *host_state = find_host_state(engine, task->request.host, task->request.port);
+        if (!host_state) {
+            finish_http_task(engine, task, false);
+            continue;
+        }
+
+        // a retry waits out its backoff
+        if (task->retry_at > now) {
+            if (task->retry_at < engine->next_retry) engine->next_retry = task->retry_at;
+            queue_waiting_task(engine, task);
+            continue;
+        }
+
+        if (!circuit_allows(engine, host_state, task, now)) {
+            finish_http_task(engine, task, false);
+            continue;
+        }
+
+        // warming up is pointless if the host already has a connection, or is getting one, but a probe needs a connection of its own
+        if (task->request.warm_up && (host_state->circuit == CIRCUIT_CLOSED)) {
+            const bool connected = host_state->http2_connection || host_state->probing_protocol || (host_state->active_connections > 0) || 
+                                   (count_idle_connections(&connection_pool, task->request.host, task->request.port) > 0);
+            if (connected || (host_state->active_connections >= MAX_CONNECTIONS_PER_HOST)) {
+                finish_http_task(engine, task, true);
+                continue;
+            }
+        }
+
+        // limited requests wait until their host's concurrency allows another one
+        task->started_at = get_monotonic_time();
+        task->sent_at = 0;
+        task->timings.started = task->started_at;
+        task->timings.resolved = task->timings.connected = task->timings.handshaken = task->timings.first_byte = 0;
+        if (task->request.limited) {
+            if (!below_concurrency_limit(host_state)) {
+                queue_waiting_task(engine, task);
+                continue;
+            }
+
+            task->counted = true;
+            host_state->limited_in_flight++;
+        }
+
+        if (task->request.allow_http2) {
+            Connection *http2_connection = host_state->http2_connection;
+            if (http2_connection) {
+                // a warm-up has nothing to send as a stream, the open session is the connection it wanted, 
+                // and a ping on it answers for the probe of a half open circuit (finishing counts as its success)
+                if (task->request.warm_up) {
+                    nghttp2_submit_ping(http2_connection->http2, NGHTTP2_FLAG_NONE, NULL);
+                    advance_http2_connection(engine, http2_connection);
+                    finish_http_task(engine, task, host_state->http2_connection == http2_connection);
+                    continue;
+                }
+
+                uint32_t max_streams = nghttp2_session_get_remote_settings(http2_connection->http2, NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS);
+                if (max_streams > MAX_HTTP2_STREAMS) max_streams = MAX_HTTP2_STREAMS;
+
+                if (http2_connection->http2_streams < max_streams) {
+                    start_http2_stream(engine, http2_connection, task);
+                    advance_http2_connection(engine, http2_connection);
+                }
+                else queue_waiting_task(engine, task);
+                continue;
+            }
+
+            if (host_state->probing_protocol) {
+                queue_waiting_task(engine, task);
+                continue;
+            }
+        }
+
+        // over http/1.1 a request rather waits behind others on an open connection than for a new one,
+        // unless an idle connection is ready for it
+        const bool pipelining = task->request.allow_pipelining && !host_state->pipelining_broken && 
+                                (!task->request.allow_http2 || (host_state->protocol == PROTOCOL_HTTP1));
+        if (pipelining && host_state->pipeline && (host_state->pipeline->pipeline_depth < MAX_PIPELINE_DEPTH) && 
+            (count_idle_connections(&connection_pool, task->request.host, task->request.port) == 0)) {
+            attach_to_pipeline(engine, host_state->pipeline, task);
+            continue;
+        }
+
+        if (host_state->active_connections < MAX_CONNECTIONS_PER_HOST) {
+            host_state->active_connections++;
+            if (pipelining) host_state->pipeline = task;
+            start_http_task(engine, task, host_state);
+        }
+
+        else queue_waiting_task(engine, task);
+    }
+}
+
+// drops every request that ran out of time or whose token was cancelled, wherever it is in its lifetime
+void expire_http_tasks(HttpEngine *engine)
+{
+    const double now = get_monotonic_time();
+    engine->next_deadline_check = now + DEADLINE_CHECK_INTERVAL;
+
+    HTTP_Task *task = engine->active;
+    while (task) {
+        HTTP_Task *next = task->next;
+        for (HTTP_Task *pipelined = task->pipeline_next; pipelined; pipelined = pipelined->pipeline_next) {
+            if (pipelined->callback && http_task_expired(pipelined, now)) {
+                print_expired_http_task(pipelined);
+                abandon_http_task(pipelined, now);
+            }
+        }
+
+        if (http_task_expired(task, now)) {
+            print_expired_http_task(task);
+
+            // the rest of the http/2 connection is unaffected, only the stream is reset
+            if (task->state == TASK_STREAMING) {
+                nghttp2_session *session = task->connection->http2;
+                nghttp2_session_set_stream_user_data(session, task->stream_id, NULL);
+                nghttp2_submit_rst_stream(session, NGHTTP2_FLAG_NONE, task->stream_id, NGHTTP2_CANCEL);
+            }
+
+            finish_http_task(engine, task, false);
+        }
+        task = next;
+    }
+
+    // after the active tasks, whose pipelined requests may have gone back to waiting
+    HTTP_Task *waiting = engine->waiting_head;
+    engine->waiting_head = engine->waiting_tail = NULL;
+    while (waiting) {
+        HTTP_Task *task = waiting;
+        waiting = waiting->next;
+        
+        if (http_task_expired(task, now)) {
+            print_expired_http_task(task);
+            finish_http_task(engine, task, false);
+        }
+        else queue_waiting_task(engine, task);
+    }
+
+    // sends the resets, a connection that stopped answering altogether is dropped along with its streams
+    for (HostState *host_state = engine->hosts; host_state; host_state = host_state->next) {
+        Connection *connection = host_state->http2_connection;
+        if (!connection) continue;
+        
+        const bool stalled = (connection->http2_streams > 0) && ((now - connection->last_received) >= DEFAULT_REQUEST_TIMEOUT);
+        if (stalled) {
+            printf("expire_http_tasks: http/2 connection to %s stalled\n", connection->host);
+            close_http2_connection(engine, connection);
+        }
+        else advance_http2_connection(engine, connection);
+    }
+}
+
+// wakes the engine up for the next deadline check, raced connect or retry while there are requests, and for probes of open circuits
+int milliseconds_until_next_timer(const HttpEngine *engine)
+{
+    if (!engine->active && !engine->waiting_head && (engine->next_probe == INFINITY)) return -1;
+
+    const double next_timer = fmin(fmin(engine->next_deadline_check, engine->next_connect_attempt), fmin(engine->next_retry, engine->next_probe));
+    const double remaining = next_timer - get_monotonic_time();
+    return (remaining > 0) ? (int) (remaining * 1000) + 1 : 0;
+}
+
+// moves on whatever waits for the connection once its socket is ready
+void advance_connection(HttpEngine *engine, Connection *connection)
+{
+    if (connection->http2) {
+        advance_http2_connection(engine, connection);
+    }
+    else if (connection->task && (connection->task->state == TASK_CONNECTING)) {
+        int error = 0;
+        socklen_t len = sizeof(error);
+        if (getsockopt(connection->sockfd, SOL_SOCKET, SO_ERROR, &error, &len) != 0) error = errno;
+        on_connect_attempt_done(engine, connection->task, connection, error);
+    }
+    else if (connection->task) {
+        advance_http_task(engine, connection->task);
+    }
+}
+
+int handle_epoll_events(HttpEngine *engine, const int timeout_ms)
+{
+    struct epoll_event events[64];
+    const int n = epoll_wait(engine->epoll_fd, events, sizeof(events) / sizeof(events[0]), timeout_ms);
+    if ((n < 0) && (errno != EINTR)) {
+        printf("handle_epoll_events: epoll_wait failed\n");
+        return -1;
+    }
+
+    for (int i = 0; i < n; i++) {
+        Connection *connection = (Connection*) events[i].data.ptr;
+        if (!connection) {
+            uint64_t count;
+            if (read(engine->wake_fd, &count, sizeof(count)) < 0) {
+                printf("handle_epoll_events: could not read wake_fd\n");
+            }
+        }
+        else advance_connection(engine, connection);
+    }
+
+    return 0;
+}
+
+void submit_uring_wake_read(HttpEngine *engine)
+{
+    struct io_uring_sqe *sqe = get_uring_sqe(engine->uring);
+    if (!sqe) return;
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = engine->wake_fd;
+    sqe->addr = (uint64_t) (uintptr_t) &engine->wake_count;
+    sqe->len = sizeof(engine->wake_count);
+    sqe->user_data = URING_WAKE;
+}
+
+// hands the result of an operation of the ring to whatever waits for it, 
+// the operation's connection took the place of an epoll event for the same readiness
+void on_uring_completion(HttpEngine *engine, const uint64_t user_data, const int result)
+{
+    Connection *connection = (Connection*) (uintptr_t) (user_data & ~(uint64_t) URING_OPERATION_MASK);
+    const int operation = user_data & URING_OPERATION_MASK;
+    if (!connection) {
+        if (operation == URING_WAKE) submit_uring_wake_read(engine);
+        return;
+    }
+
+    switch (operation) {
+        case URING_CONNECT:
+            connection->connecting = false;
+            connection->connected = (result == 0);
+            break;
+        case URING_RECEIVE:
+            connection->receiving = false;
+            // openssl sees the end of the connection once it read everything that came before it
+            if (result > 0) BIO_write(SSL_get_rbio(connection->ssl), connection->uring_input, result);
+            else BIO_set_mem_eof_return(SSL_get_rbio(connection->ssl), 0);
+            break;
+        case URING_SEND:
+            connection->sending = false;
+            if (result > 0) {
+                connection->uring_output_start += result;
+            }
+            else if (!connection->closing) {
+                // the next receive fails as well, which tells the user of the connection
+                printf("on_uring_completion: send to %s failed (%s)\n", connection->host, strerror(-result));
+                connection->uring_output_start = connection->uring_output_end;
+                shutdown(connection->sockfd, SHUT_RDWR);
+            }
+            break;
+    }
+
+    // frees the connection once none of its operations is in flight anymore
+    if (connection->closing) {
+        close_connection(connection);
+        return;
+    }
+
+    switch (operation) {
+        case URING_CONNECT:
+            on_connect_attempt_done(engine, connection->task, connection, -result);
+            break;
+        case URING_RECEIVE:
+            if (connection->watched_events & EPOLLIN) advance_connection(engine, connection);
+            break;
+        case URING_SEND:
+            submit_uring_output(connection);
+            if (connection->watched_events & EPOLLOUT) advance_connection(engine, connection);
+            break;
+    }
+}
+
+int handle_uring_completions(HttpEngine *engine, const int timeout_ms)
+{
+    IoUring *ring = engine->uring;
+    if (enter_io_uring(ring, timeout_ms) != 0) {
+        return -1;
+    }
+
+    unsigned head = *ring->cq_head;
+    while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        const struct io_uring_cqe cqe = ring->cqes[head & *ring->cq_mask];
+        head++;
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+        ring->in_flight--;
+
+        on_uring_completion(engine, cqe.user_data, cqe.res);
+    }
+
+    return 0;
+}
+
+// defined below warm_up_connection, which sends the probes
+void probe_open_circuits(HttpEngine *engine);
+
+void* http_engine_thread(void *args)
+{
+    HttpEngine *engine = (HttpEngine*) args;
+
+    while (true) {
+        const int timeout_ms = milliseconds_until_next_timer(engine);
+        const int handled = engine->uring ? handle_uring_completions(engine, timeout_ms) : handle_epoll_events(engine, timeout_ms);
+        if (handled != 0) {
+            break;
+        }
+        close_retired_connections(engine);
+
+        // take over the newly submitted requests
+        pthread_mutex_lock(&engine->mutex);
+            HTTP_Task *submitted = engine->submitted_head;
+            engine->submitted_head = engine->submitted_tail = NULL;
+            const bool running = engine->running;
+            const bool cancel_requested = engine->cancel_requested;
+            engine->cancel_requested = false;
+        pthread_mutex_unlock(&engine->mutex);
+
+        if (submitted) {
+            if (engine->waiting_tail) engine->waiting_tail->next = submitted;
+            else engine->waiting_head = submitted;
+            while (submitted->next) submitted = submitted->next;
+            engine->waiting_tail = submitted;
+        }
+
+        if (!running) break;
+        if (timings_dump_requested) {
+            timings_dump_requested = 0;
+            print_request_timings(engine);
+        }
+
+        if (cancel_requested || (get_monotonic_time() >= engine->next_deadline_check)) {
+            expire_http_tasks(engine);
+        }
+        
+        if (get_monotonic_time() >= engine->next_connect_attempt) {
+            start_due_connect_attempts(engine);
+        }
+
+        if (get_monotonic_time() >= engine->next_probe) {
+            probe_open_circuits(engine);
+        }
+
+        resume_resolving_tasks(engine);
+        dispatch_waiting_tasks(engine);
+        close_retired_connections(engine);
+    }
+
+    // fail whatever is left so that nobody waits on it forever, without holding it against the host's concurrency limit
+    engine->stopping = true;
+    for (HostState *host_state = engine->hosts; host_state; host_state = host_state->next) {
+        if (host_state->http2_connection) {
+            Connection *connection = host_state->http2_connection;
+            HTTP_Task *task = engine->active;
+            while (task) {
+                HTTP_Task *next = task->next;
+                if ((task->state == TASK_STREAMING) && (task->connection == connection)) {
+                    nghttp2_session_set_stream_user_data(connection->http2, task->stream_id, NULL);
+                    uncount_limited_task(engine, task, -1, false);
+                    finish_http_task(engine, task, false);
+                }
+                task = next;
+            }
+
+            close_http2_connection(engine, connection);
+        }
+    }
+
+    while (engine->active) {
+        uncount_limited_task(engine, engine->active, -1, false);
+        finish_http_task(engine, engine->active, false);
     }
 
-    thumbnail_data->next = NULL;
+    while (engine->waiting_head) {
+        HTTP_Task *task = engine->waiting_head;
+        engine->waiting_head = task->next;
+        finish_http_task(engine, task, false);
+    }
+    engine->waiting_tail = NULL;
+    close_retired_connections(engine);
+    close_idle_connections(&connection_pool);
 
-    if (thumbnail_queue->count == 0) 
-        thumbnail_queue->head = thumbnail_queue->tail = thumbnail_data;
-    else {
-        thumbnail_queue->tail->next = thumbnail_data;
-        thumbnail_queue->tail = thumbnail_data;
+    // the connections closed above are freed as soon as the ring has cancelled their operations, only the read of wake_fd stays
+    for (int i = 0; engine->uring && (engine->uring->in_flight > 1) && (i < 100); i++) {
+        if (handle_uring_completions(engine, 10) != 0) break;
     }
 
-    thumbnail_queue->count++;
+    return NULL;
 }
 
-ThumbnailData* dequeue_thumbnail(ThumbnailQueue *thumbnail_queue)
+int init_http_engine(HttpEngine *engine)
 {
-    if (!thumbnail_queue) {
-        printf("dequeue_thumbnail: 'thumbnail_queue' arg is NULL\n");
-        return NULL;
+    engine->running = false;
+    engine->submitted_head = engine->submitted_tail = NULL;
+    engine->waiting_head = engine->waiting_tail = NULL;
+    engine->active = NULL;
+    engine->hosts = NULL;
+    engine->cancel_requested = false;
+    engine->next_deadline_check = 0;
+    engine->next_connect_attempt = INFINITY;
+    engine->next_retry = INFINITY;
+    engine->next_probe = INFINITY;
+    engine->random_seed = (unsigned) time(NULL) ^ (unsigned) getpid();
+    engine->stopping = false;
+    engine->open_circuits = 0;
+    engine->retired_connections = NULL;
+    engine->connect_count = 0;
+    engine->epoll_fd = -1;
+    engine->uring = NULL;
+    pthread_mutex_init(&engine->mutex, NULL);
+
+    // a peer closing a connection we write to must not kill the application
+    signal(SIGPIPE, SIG_IGN);
+
+    if (ctx == NULL) {
+        ctx = create_ssl_ctx();
+        if (!ctx) return -1;
     }
 
-    if (thumbnail_queue->count == 0) {
-        printf("dequeue_thumbnail: 'thumbnail_queue' arg is empty\n");
-        return NULL;
+    engine->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (engine->wake_fd < 0) {
+        printf("init_http_engine: could not create event file descriptor\n");
+        return -1;
     }
 
-    ThumbnailData *ret = thumbnail_queue->head;
+    // kill -USR1 prints the phase timings of every host
+    signal(SIGUSR1, request_timings_dump);
 
-    thumbnail_queue->head = ret->next;
-    if (!thumbnail_queue->head) {
-        thumbnail_queue->tail = NULL;
+    if (io_uring_backend) {
+        if (init_io_uring(&uring) == 0) {
+            engine->uring = &uring;
+            submit_uring_wake_read(engine);
+        }
+        else {
+            printf("init_http_engine: io_uring is not available, using epoll\n");
+            io_uring_backend = false;
+        }
     }
 
-    thumbnail_queue->count--;
-
-    return ret;
-}
+    if (!engine->uring) {
+        engine->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (engine->epoll_fd < 0) {
+            printf("init_http_engine: could not create epoll file descriptor\n");
+            return -1;
+        }
 
-void free_thumbnail_queue(ThumbnailQueue *thumbnail_queue)
-{
-    if (!thumbnail_queue) return;
+        struct epoll_event event = { .events = EPOLLIN, .data.ptr = NULL };
+        if (epoll_ctl(engine->epoll_fd, EPOLL_CTL_ADD, engine->wake_fd, &event) != 0) {
+            printf("init_http_engine: epoll_ctl failed for wake_fd\n");
+            return -1;
+        }
+    }
 
-    while (thumbnail_queue->head) {
-        ThumbnailData *to_free = thumbnail_queue->head;
-        thumbnail_queue->head = thumbnail_queue->head->next;
-        free_thumbnail_data(to_free);
+    if (start_dns_resolver(&dns_cache, engine->wake_fd) != 0) {
+        return -1;
     }
 
-    thumbnail_queue->count = 0;
-    thumbnail_queue->head = thumbnail_queue->tail = NULL;
+    engine->running = true;
+    if (pthread_create(&engine->thread, NULL, http_engine_thread, engine) != 0) {
+        printf("init_http_engine: pthread_create failed\n");
+        engine->running = false;
+        stop_dns_resolver(&dns_cache);
+        return -1;
+    }
 
-    pthread_mutex_destroy(&thumbnail_queue->mutex);
+    return 0;
 }
 
-#define MINUTE 60
-#define CACHED_THUMBNAIL_LIFETIME (MINUTE * 3)
-
-// thumbnails stored seperatley and will be deleted when they expire (n seconds without use)
-// useful when preforming similar searches within a smaller time interval 
+void wake_http_engine(HttpEngine *engine)
+{
+    const uint64_t one = 1;
+    if (write(engine->wake_fd, &one, sizeof(one)) < 0) {
+        printf("wake_http_engine: could not write to wake_fd\n");
+    }
+}
 
-void configure_youtube_search_query_path(const size_t n, char search_url[n], const Query query)
+// makes the engine drop the requests of cancelled tokens now rather than at its next deadline check
+void expire_cancelled_http_requests(HttpEngine *engine)
 {
-    // get the corresp. sorting param values 
-    const char *sort = sort_type_to_url(query.sort);
-    const char *media = media_type_to_url(query.media);
+    pthread_mutex_lock(&engine->mutex);
+        engine->cancel_requested = true;
+    pthread_mutex_unlock(&engine->mutex);
+    
+    wake_http_engine(engine);
+}
 
-    // configure the query path 
-    snprintf(search_url, n, "/results?search_query=%s&sp=%s%s", query.encoded_query, sort, media);
+// fails every request still in flight and stops the engine thread, later submissions fail right away
+void stop_http_engine(HttpEngine *engine)
+{
+    pthread_mutex_lock(&engine->mutex);
+        const bool was_running = engine->running;
+        engine->running = false;
+    pthread_mutex_unlock(&engine->mutex);
+
+    if (was_running) {
+        wake_http_engine(engine);
+        pthread_join(engine->thread, NULL);
+        stop_dns_resolver(&dns_cache);
+    }
 }
 
-void configure_query_path(const size_t n, char search_url[n], const SortType sort, const MediaType media, const char *encoded_query)
+// expects no other thread to use the engine anymore
+void free_http_engine(HttpEngine *engine)
 {
-    // get the corresp. sorting param values 
-    const char *sort_param = sort_type_to_url(sort);
-    const char *media_param = media_type_to_url(media);
+    stop_http_engine(engine);
 
-    // configure the query path 
-    snprintf(search_url, n, "/results?search_query=%s&sp=%s%s", encoded_query, sort_param, media_param);
+    while (engine->hosts) {
+        HostState *to_free = engine->hosts;
+        engine->hosts = to_free->next;
+        free(to_free);
+    }
+
+    if (engine->uring) free_io_uring(engine->uring);
+    if (engine->epoll_fd >= 0) close(engine->epoll_fd);
+    if (engine->wake_fd >= 0) close(engine->wake_fd);
+    pthread_mutex_destroy(&engine->mutex);
 }
 
-// trims the fat (data not enclosed in object specified by tag) in place
-// compatible for both arrays ('[' and ']') and objects ('{' and '}')
-int parse_json_object(Buffer *buffer, const char *object, const char opening, const char closing)
+// queues a request on the engine, 'callback' is invoked exactly once with the response body 
+// the body is written into the memory of 'response', which the engine owns from here on (see take_scratch_buffer)
+void submit_https_request_into(HttpEngine *engine, const HTTP_Request *req, Buffer response, HTTP_Callback callback, void *user_data)
 {
-    char *object_position = strstr(buffer->data, object);
-    if (object_position) {
-        char *start = strchr(object_position, opening);            
-        
-        // find the end position, the closing char 
-        char *current = start;
-        int depth = 0;
-
-        for ( ; current ; current++) {
-            if (*current == opening) {
-                depth++;
-            }
+    response.size = 0;
 
-            else if (*current == closing) {
-                depth--;
-            }
+    HTTP_Task *task = malloc(sizeof(HTTP_Task));
+    if (!task) {
+        printf("submit_https_request: malloc returned NULL for task\n");
+        free_buffer(&response);
+        callback(init_buffer(), user_data);
+        return;
+    }
 
-            if (depth == 0) {
+    task->state = TASK_WAITING;
+    task->request = *req;
+    task->response = response;
+    memset(&task->timings, 0, sizeof(task->timings));
+    task->timings.submitted = get_monotonic_time();
+    task->cached = false;
+    if (req->extract_object) init_object_extractor(&task->extractor, req->extract_object);
+
+    if (req->cacheable) {
+        char conditions[256];
+        switch (check_response_cache(&response_cache, req->host, req->path, sizeof(conditions), conditions, &task->response)) {
+            case CACHE_FRESH:
+                // the callback runs on the engine thread all the same
+                task->cached = true;
+                break;
+            case CACHE_STALE: {
+                // the conditional fields go right before the blank line that ends the header
+                const size_t header_len = strlen(req->header);
+                const bool fits = (header_len >= 4) && 
+                    (snprintf(task->request.header, sizeof(task->request.header), "%.*s%s\r\n", (int) (header_len - 2), req->header, conditions) < (int) sizeof(task->request.header));
+                if (!fits) snprintf(task->request.header, sizeof(task->request.header), "%s", req->header);
                 break;
             }
-        }
-
-        if (depth == 0) {
-            // calculate the number of characters the object data contains
-            char *end = current;
-            const size_t nchars = end - start + 1; 
-            
-            // shift the data to the front of the objects memory
-            memmove(buffer->data, start, nchars);
-            return resize_buffer(buffer, nchars);
-        }
-
-        else {
-            printf("parse_json_object: the opening %c and closing %c of the json object is unbalanced %d\n", opening, closing, depth);
-            return -1;
+            case CACHE_MISS:
+            default:
+                break;
         }
     }
 
-    printf("parse_json_object: \"%s\" was not found\n", object);
-    return -1;
-}
-
-// read one line from ssl stream or n bytes into buffer (whichever comes first)
-size_t ssl_read_line(SSL *ssl, char *buffer, const size_t n) 
-{
-    if (!buffer) {
-        printf("ssl_read_line: buffer is NULL\n");
-        return 0;
+    task->out_len = snprintf(task->out, sizeof(task->out), "%s%s", task->request.header, req->body);
+    if (task->out_len >= sizeof(task->out)) {
+        printf("submit_https_request: request to %s%s is too large\n", req->host, req->path);
+        free_buffer(&task->response);
+        free(task);
+        callback(init_buffer(), user_data);
+        return;
     }
-    
-    const char *CRLF = "\r\n";
-    const size_t CRLF_len = strlen(CRLF);
-
-    size_t pos = 0;
-    char c;
 
-    while (pos < n - 1) {
-        // read one char
-        int byte = SSL_read(ssl, &c, 1);
-        if (byte <= 0) {
-            printf("ssl_read_line: SSL_read returned %d\n", byte);
-            return 0;
+    task->retried = false;
+    task->retries = 0;
+    task->retry_at = 0;
+    task->counted = false;
+    task->probe = false;
+    task->started_at = 0;
+    task->sent_at = 0;
+    task->deadline = get_monotonic_time() + ((req->timeout > 0) ? req->timeout : DEFAULT_REQUEST_TIMEOUT);
+    task->probing_protocol = false;
+    task->stream_id = 0;
+    task->connection = NULL;
+    task->pipeline_next = NULL;
+    task->pipeline_tail = task;
+    task->pipeline_depth = 1;
+    task->candidates.count = 0;
+    task->next_candidate = 0;
+    task->attempt_count = 0;
+    init_http_response(&task->http_response);
+    task->body_coding = BODY_UNDECIDED;
+    task->callback = callback;
+    task->user_data = user_data;
+    task->prev = task->next = NULL;
+
+    pthread_mutex_lock(&engine->mutex);
+        const bool running = engine->running;
+        if (running) {
+            if (engine->submitted_tail) engine->submitted_tail->next = task;
+            else engine->submitted_head = task;
+            engine->submitted_tail = task;
         }
+    pthread_mutex_unlock(&engine->mutex);
 
-        // add character to buffer
-        buffer[pos++] = c;
-
-        // checking if we've reached end of line
-        if ((pos >= CRLF_len) && strstr(buffer, CRLF)) {
-            break;
-        }
+    if (!running) {
+        free_buffer(&task->response);
+        free(task);
+        callback(init_buffer(), user_data);
+        return;
     }
 
-    buffer[pos] = '\0';
-    
-    return pos;
+    wake_http_engine(engine);
 }
 
-// read the header of a http response or n bytes into buffer (whichever comes first)
-size_t read_header(SSL *ssl, char *header, size_t n)
+void submit_https_request(HttpEngine *engine, const HTTP_Request *req, HTTP_Callback callback, void *user_data)
 {
-    size_t total_len = 0;
-    const char *header_end = "\r\n\r\n";
-
-    while ((strstr(header, header_end) == NULL) && (total_len < n - 1)) {
-        const size_t len = ssl_read_line(ssl, (header + total_len), (n - total_len));
-        if (len == 0) {
-            printf("read_header: read_line returned 0 bytes read\n");
-            break;  
-        }
+    submit_https_request_into(engine, req, init_buffer(), callback, user_data);
+}
 
-        total_len += len;
-    }   
+void on_warm_up_done(Buffer response, void *user_data)
+{
+    free_buffer(&response);
+}
 
-    return total_len;
+// resolves host and establishes a connection to it in the background unless one is already open,
+// so that the next request to the host skips the dns lookup and the tcp and tls handshakes
+void warm_up_connection(HttpEngine *engine, char *host, char *port, const bool allow_http2)
+{
+    HTTP_Request http_req = {0};
+    http_req.host = host;
+    http_req.port = port;
+    http_req.allow_http2 = allow_http2;
+    http_req.warm_up = true;
+    snprintf(http_req.path, sizeof(http_req.path), "/");
+
+    submit_https_request(engine, &http_req, on_warm_up_done, NULL);
 }
 
-// read n bytes from ssl stream into buffer
-void ssl_read_n(SSL *ssl, Buffer *buffer, const size_t n)
+// sends a probe to every host whose circuit has been open long enough, and opens those again whose probe never answered
+void probe_open_circuits(HttpEngine *engine)
 {
-    char data[4096] = {0};
-    size_t bytes_remaining = n;
-    while (bytes_remaining > 0) {
-        size_t to_read = bytes_remaining < sizeof(data) ? bytes_remaining : sizeof(data);
-        
-        int read = SSL_read(ssl, data, to_read);
-        if (read <= 0) {
-            printf("ssl_read_n: SSL read returned %d\n", read);
-            break;
+    const double now = get_monotonic_time();
+    engine->next_probe = INFINITY;
+
+    for (HostState *host_state = engine->hosts; host_state; host_state = host_state->next) {
+        if ((host_state->circuit != CIRCUIT_CLOSED) && (now >= host_state->circuit_open_until)) {
+            if (host_state->circuit == CIRCUIT_HALF_OPEN) {
+                printf("probe_open_circuits: the probe of %s did not answer\n", host_state->host);
+                record_host_outcome(engine, host_state, true, now);
+            }
+            else {
+                half_open_circuit(engine, host_state, now);
+                warm_up_connection(engine, host_state->host, host_state->port, host_state->protocol != PROTOCOL_HTTP1);
+            }
         }
 
-        write_data_to_buffer(buffer, data, read);
-        
-        bytes_remaining -= read;
-    }      
+        if ((host_state->circuit != CIRCUIT_CLOSED) && (host_state->circuit_open_until < engine->next_probe)) {
+            engine->next_probe = host_state->circuit_open_until;
+        }
+    }
 }
 
+// lets a thread wait for the engine to complete a request
 typedef struct
 {
-    char *port;
-    char *host;
-    char path[256];
-    char body[1024];
-    char header[1024];
-} HTTP_Request;
+    bool done;
+    Buffer response;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} BlockingRequest;
 
-bool header_contains_tag(const char *header, const char *tag)
+void on_blocking_request_done(Buffer response, void *user_data)
 {
-    return strstr(header, tag);
+    BlockingRequest *blocking_request = (BlockingRequest*) user_data;
+
+    pthread_mutex_lock(&blocking_request->mutex);
+        blocking_request->response = response;
+        blocking_request->done = true;
+        pthread_cond_signal(&blocking_request->cond);
+    pthread_mutex_unlock(&blocking_request->mutex);
 }
 
-size_t get_content_len (const char *header)
+// every thread that sends blocking requests keeps the memory of its last response, so that once its 
+// responses stop growing, receiving one needs no allocation (see return_scratch_buffer)
+static __thread Buffer scratch_buffer;
+
+Buffer take_scratch_buffer()
 {
-    // find the content length parameter
-    char *location = strstr(header, "Content-Length:");
-    
-    // find the first numeric char
-    char *first_numeric = location;
-    while (first_numeric && !isdigit(*first_numeric)) {
-        first_numeric++;
-    } 
+    Buffer buffer = scratch_buffer;
+    scratch_buffer = init_buffer();
+    buffer.size = 0;
+    return buffer;
+}
 
-    // read every numeric char into a buffer
-    int i = 0;
-    char bytes[16] = {0};
-    while (first_numeric && isdigit(*first_numeric)) {
-        bytes[i++] = *first_numeric;
-        first_numeric++;
+// hands a response back to the calling thread's scratch buffer instead of freeing it
+void return_scratch_buffer(Buffer *buffer)
+{
+    if (buffer->capacity > scratch_buffer.capacity) {
+        free_buffer(&scratch_buffer);
+        scratch_buffer = *buffer;
     }
+    else free_buffer(buffer);
 
-    // return numeric representation
-    return atoi(bytes);
-
-    return 0;
+    *buffer = init_buffer();
 }
 
-SSL_CTX *ctx = NULL;
-struct addrinfo *addrinfo = NULL;
+// expected before a thread that sent blocking requests exits
+void free_scratch_buffer()
+{
+    free_buffer(&scratch_buffer);
+}
 
-// returns the response body of a http request in a Buffer
+// returns the response body of a http request in a Buffer, blocking the calling thread until it arrives
+// the buffer is the thread's scratch buffer, ideally given back with return_scratch_buffer once it is processed
 Buffer send_https_request(const HTTP_Request req)
 {
-    if (ctx == NULL) {
-        ctx = SSL_CTX_new(TLS_client_method());
-        if (!ctx) {
-            printf("send_https_request: SSL_CTX_new failed\n");
-            return (Buffer){0};
-        }
-    }
-
-    // DNS resolution, looking up the ip address for a website name 
-    // res is full of info needed to create a socket
-    if (addrinfo == NULL) {
-        struct addrinfo desired_addr_info = {0};
-        desired_addr_info.ai_family = AF_UNSPEC;
-        desired_addr_info.ai_socktype = SOCK_STREAM;
-        if (getaddrinfo(req.host, req.port, &desired_addr_info, &addrinfo) != 0) {
-            printf("send_https_request: getaddrinfo failed\n");
-            addrinfo = NULL;
-            return (Buffer){0};
-        }
-    }
-
-    // initializing socket
-    int sockfd = socket(addrinfo->ai_family, addrinfo->ai_socktype, addrinfo->ai_protocol);
-    if (sockfd < 0) {
-        printf("send_https_request: socket failed\n");
-        freeaddrinfo(addrinfo);
-        addrinfo = NULL;
-        return (Buffer){0};
-    }
-
-    // connection between socket and ip address
-    if (connect(sockfd, addrinfo->ai_addr, addrinfo->ai_addrlen) != 0) {
-        printf("send_https_request: connect failed\n");
-        freeaddrinfo(addrinfo);
-        addrinfo = NULL;
-        close(sockfd);
-        return (Buffer){0};
-    }
-
-    SSL *ssl = SSL_new(ctx);
-    SSL_set_fd(ssl, sockfd);
-    if (SSL_connect(ssl) != 1) {
-        freeaddrinfo(addrinfo);
-        addrinfo = NULL;
-        close(sockfd);
-        SSL_shutdown(ssl);
-        SSL_free(ssl);
-        SSL_CTX_free(ctx);
-        return (Buffer){0};
-    }
-
-    // sending header
-    int header_write_status;
-    if ((header_write_status = SSL_write(ssl, req.header, strlen(req.header))) <= 0) {
-        printf("send_https_request: SSL_write (header) failed\n");
-        freeaddrinfo(addrinfo);
-        addrinfo = NULL;
-        close(sockfd);
-        SSL_shutdown(ssl);
-        SSL_free(ssl);
-        SSL_CTX_free(ctx);
-        return (Buffer){0};
-    } 
+    BlockingRequest blocking_request;
+    blocking_request.done = false;
+    blocking_request.response = init_buffer();
+    pthread_mutex_init(&blocking_request.mutex, NULL);
+    pthread_cond_init(&blocking_request.cond, NULL);
 
-    // send body
-    if (req.body[0] != '\0') {
-        int body_write_status = SSL_write(ssl, req.body, strlen(req.body));
-        if (body_write_status <= 0) {
-            printf("send_https_request: SSL_write (body) failed\n");
-            freeaddrinfo(addrinfo);
-            addrinfo = NULL;
-            close(sockfd);
-            SSL_shutdown(ssl);
-            SSL_free(ssl);
-            SSL_CTX_free(ctx);
-            return (Buffer){0};
-        }
-    }
-
-    // extract header from ssl stream
-    char header[4096] = {0};
-    size_t header_len = read_header(ssl, header, sizeof(header));
-    header[header_len] = '\0';
-    if (header_len == 0) {
-        printf("send_https_request: read_header returned 0\n");
-        freeaddrinfo(addrinfo);
-        addrinfo = NULL;
-        close(sockfd);
-        SSL_shutdown(ssl);
-        SSL_free(ssl);
-        SSL_CTX_free(ctx);
-        return (Buffer){0};
-    }
-
-    Buffer response = init_buffer();
-
-    // read n bytes into buffer if content length tag is present
-    if (header_contains_tag(header, "Content-Length:")) {
-        size_t content_length = get_content_len(header);
-        if (content_length > 0) {
-            ssl_read_n(ssl, &response, content_length);
-        }
-    }
-
-    else if (header_contains_tag(header, "Transfer-Encoding: chunked")) {
-        const char *crlf = "\r\n";
-        const size_t crlf_len = strlen(crlf);
-        
-        int chunk_size = -1; 
-        while (chunk_size != 0) {
-            // read chunk size line
-            char hex[16] = {0};
-            int len = ssl_read_line(ssl, hex, sizeof(hex));
-            if (len <= 0) {
-                printf("send_https_request: failed to read chunk size\n");
-                break;
-            }
+    submit_https_request_into(&http_engine, &req, take_scratch_buffer(), on_blocking_request_done, &blocking_request);
 
-            // parse hex
-            if (len >= crlf_len) hex[len - crlf_len] = '\0';
-            chunk_size = strtol(hex, NULL, 16);
-            
-            if (chunk_size > 0) {
-                // read chunk_size bytes into response
-                ssl_read_n(ssl, &response, chunk_size);
-                    
-                // absorb trailing CRLF from ssl stream
-                char trailing_crlf[16];
-                ssl_read_line(ssl, trailing_crlf, sizeof(trailing_crlf));
-            }
-        }
-    }
+    pthread_mutex_lock(&blocking_request.mutex);
+        while (!blocking_request.done) 
+            pthread_cond_wait(&blocking_request.cond, &blocking_request.mutex);
+    pthread_mutex_unlock(&blocking_request.mutex);
 
-    close(sockfd);
-    SSL_shutdown(ssl);
-    SSL_free(ssl);
+    pthread_mutex_destroy(&blocking_request.mutex);
+    pthread_cond_destroy(&blocking_request.cond);
 
-    return response;
+    return blocking_request.response;
 }
 
 // returns an allocated string that is the url encoding of the string passed
@@ -796,7 +5442,8 @@ int configure_get_header(const size_t n, char request[n], const char *host, cons
         "GET %s HTTP/1.1\r\n"
         "Host: %s\r\n"
         "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64; rv:125.0) Gecko/20100101 Firefox/125.0\r\n"
-        "Connection: close\r\n"
+        "Accept-Encoding: gzip, deflate\r\n"
+        "Connection: keep-alive\r\n"
         "\r\n",
         path, host);
 
@@ -829,6 +5476,51 @@ int configure_post_body(const size_t n, char post_body[n], const char *continuat
     else return chars_written;
 }
 
+// the first page of a search through the api, with the same sort and media filter the results page gets as 'sp'
+int configure_search_post_body(const size_t n, char post_body[n], const char *search_text, const Query query)
+{
+    // quotes, backslashes and control characters have to be escaped inside a json string
+    char escaped[512];
+    size_t len = 0;
+    const char *c = search_text;
+    for (; *c && (len + 7 < sizeof(escaped)); c++) {
+        if ((*c == '"') || (*c == '\\')) {
+            escaped[len++] = '\\';
+            escaped[len++] = *c;
+        }
+        else if ((unsigned char)*c < 0x20) len += snprintf(escaped + len, sizeof(escaped) - len, "\\u%04x", *c);
+        else escaped[len++] = *c;
+    }
+    escaped[len] = '\0';
+
+    if (*c) {
+        printf("configure_search_post_body: search text is too long to escape\n");
+        return -1;
+    }
+
+    // the url carries the '=' padding of the params encoded twice, the body only once
+    const char *media = (query.media == ANY) ? "%3D" : media_type_to_url(query.media);
+
+    size_t chars_written = snprintf(post_body, n,
+        "{\n"
+        "  \"context\": {\n"
+        "    \"client\": {\n"
+        "      \"clientName\": \"WEB\",\n"
+        "      \"clientVersion\": \"2.20210721.00.00\"\n"
+        "    }\n"
+        "  },\n"
+        "  \"query\": \"%s\",\n"
+        "  \"params\": \"%s%s\"\n"
+        "}", escaped, sort_type_to_url(query.sort), media);
+
+    if (chars_written >= n) {
+        printf("configure_search_post_body: buffer is too small (%zu bytes needed)\n", chars_written);
+        return -1;
+    }
+
+    else return chars_written;
+}
+
 int configure_post_header(const size_t n, char request[n], const char *host, const char *path, const size_t post_len)
 {
     return snprintf(request, n,
@@ -837,7 +5529,8 @@ int configure_post_header(const size_t n, char request[n], const char *host, con
             "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64; rv:125.0) Gecko/20100101 Firefox/125.0\r\n"
             "Content-Type: application/json\r\n"
             "Content-Length: %zu\r\n"
-            "Connection: close\r\n"
+            "Accept-Encoding: gzip, deflate\r\n"
+            "Connection: keep-alive\r\n"
             "\r\n",
             path, host, post_len);
 }
@@ -962,7 +5655,7 @@ void format_view_count(char* view_count)
     }
 }
 
-void create_search_node_from_json(SearchResult *search_result, cJSON *item, const bool allow_shorts)
+void reset_search_result(SearchResult *search_result)
 {
     search_result->media_type = UNDF;
     search_result->thumbnail = (Texture){0};
@@ -976,6 +5669,11 @@ void create_search_node_from_json(SearchResult *search_result, cJSON *item, cons
     memset(search_result->thumbnail_path, 0, sizeof(search_result->thumbnail_path));
     memset(search_result->date_published, 0, sizeof(search_result->date_published));
     memset(search_result->subscriber_count, 0, sizeof(search_result->subscriber_count));
+}
+
+void create_search_node_from_json(SearchResult *search_result, cJSON *item, const bool allow_shorts)
+{
+    reset_search_result(search_result);
 
     // the item (the nth element of 'contents' json obj) is either a video, channel, or playlist
     // thus, only one of the values will not NULL
@@ -1165,59 +5863,289 @@ void create_search_node_from_json(SearchResult *search_result, cJSON *item, cons
     }
 }
 
+// the strings a search result is made of, only those of one of the renderers are in an item
+typedef enum
+{
+    VIDEO_ID,
+    VIDEO_URL,
+    VIDEO_TITLE,
+    VIDEO_AUTHOR,
+    VIDEO_VIEWERS,
+    VIDEO_VIEWS,
+    VIDEO_PUBLISHED,
+    VIDEO_LENGTH,
+    CHANNEL_ID,
+    CHANNEL_TITLE,
+    CHANNEL_VIDEO_COUNT,
+    CHANNEL_THUMBNAIL,
+    PLAYLIST_ID,
+    PLAYLIST_TITLE,
+    PLAYLIST_THUMBNAIL,
+    PLAYLIST_VIDEO_COUNT,
+    N_ITEM_FIELDS
+} ItemField;
+
+// where the fields are in an item of 'contents', relative to the item
+static const char *const item_field_paths[N_ITEM_FIELDS] = {
+    [VIDEO_ID] = "videoRenderer.videoId",
+    [VIDEO_URL] = "videoRenderer.navigationEndpoint.commandMetadata.webCommandMetadata.url",
+    [VIDEO_TITLE] = "videoRenderer.title.runs[0].text",
+    [VIDEO_AUTHOR] = "videoRenderer.ownerText.runs[0].text",
+    [VIDEO_VIEWERS] = "videoRenderer.viewCountText.runs[0].text",
+    [VIDEO_VIEWS] = "videoRenderer.viewCountText.simpleText",
+    [VIDEO_PUBLISHED] = "videoRenderer.publishedTimeText.simpleText",
+    [VIDEO_LENGTH] = "videoRenderer.lengthText.simpleText",
+    [CHANNEL_ID] = "channelRenderer.channelId",
+    [CHANNEL_TITLE] = "channelRenderer.title.simpleText",
+    [CHANNEL_VIDEO_COUNT] = "channelRenderer.videoCountText.simpleText",
+    [CHANNEL_THUMBNAIL] = "channelRenderer.thumbnail.thumbnails[0].url",
+    [PLAYLIST_ID] = "lockupViewModel.contentId",
+    [PLAYLIST_TITLE] = "lockupViewModel.metadata.lockupMetadataViewModel.title.content",
+    [PLAYLIST_THUMBNAIL] = "lockupViewModel.contentImage.collectionThumbnailViewModel.primaryThumbnail.thumbnailViewModel.image.sources[0].url",
+    [PLAYLIST_VIDEO_COUNT] = "lockupViewModel.contentImage.collectionThumbnailViewModel.primaryThumbnail.thumbnailViewModel"
+                             ".overlays[*].thumbnailOverlayBadgeViewModel.thumbnailBadges[*].thumbnailBadgeViewModel.text",
+};
+
+#define MAX_ITEM_FIELD 512
+
+typedef struct
+{
+    char values[N_ITEM_FIELDS][MAX_ITEM_FIELD];     // empty when the item doesn't have it
+} ItemFields;
+
+// the first string found at a path is kept, like cJSON_GetObjectItem would have found it
+int on_item_field(JsonCursor *cursor, const int field, void *user_data)
+{
+    ItemFields *fields = (ItemFields*) user_data;
+    if ((fields->values[field][0] != '\0') || (peek_json_char(cursor) != '"')) return 0;
+    return read_json_string(cursor, fields->values[field], MAX_ITEM_FIELD);
+}
+
+// same as create_search_node_from_json, with the strings already pulled out of the item
+void create_search_node_from_fields(SearchResult *search_result, const ItemFields *fields, const bool allow_shorts)
+{
+    reset_search_result(search_result);
+    const char (*values)[MAX_ITEM_FIELD] = fields->values;
+
+    if (values[VIDEO_ID][0] != '\0') {
+        if (strstr(values[VIDEO_URL], "/shorts") && !allow_shorts) {
+            return;
+        }
+
+        strncpy(search_result->id, values[VIDEO_ID], sizeof(search_result->id) - 1);
+        strncpy(search_result->title, values[VIDEO_TITLE], sizeof(search_result->title));
+        snprintf(search_result->thumbnail_path, sizeof(search_result->thumbnail_path), "/vi/%s/mqdefault.jpg", search_result->id);
+        strncpy(search_result->author, values[VIDEO_AUTHOR], sizeof(search_result->author));
+
+        // video can either be a livestream or normal vid
+        if (values[VIDEO_VIEWERS][0] != '\0') {
+            strncpy(search_result->view_count, values[VIDEO_VIEWERS], sizeof(search_result->view_count));
+            format_view_count(search_result->view_count);
+            search_result->media_type = LIVE;
+        }
+
+        else if (values[VIDEO_VIEWS][0] != '\0') {
+            strncpy(search_result->view_count, values[VIDEO_VIEWS], sizeof(search_result->view_count));
+            format_view_count(search_result->view_count);
+            search_result->media_type = VIDEO;
+        }
+
+        strncpy(search_result->date_published, values[VIDEO_PUBLISHED], sizeof(search_result->date_published));
+        strncpy(search_result->duration, values[VIDEO_LENGTH], sizeof(search_result->duration));
+    }
+
+    else if (values[CHANNEL_ID][0] != '\0') {
+        search_result->media_type = CHANNEL;
+        strncpy(search_result->id, values[CHANNEL_ID], sizeof(search_result->id) - 1);
+        strncpy(search_result->title, values[CHANNEL_TITLE], sizeof(search_result->title));
+        strncpy(search_result->subscriber_count, values[CHANNEL_VIDEO_COUNT], sizeof(search_result->subscriber_count));
+
+        // the path either starts with '/ytc', or just '/'
+        const char *path1 = strstr(values[CHANNEL_THUMBNAIL], "/ytc");
+        const char *path2 = strrchr(values[CHANNEL_THUMBNAIL], '/');
+        if (path1 || path2) strncpy(search_result->thumbnail_path, path1 ? path1 : path2, sizeof(search_result->thumbnail_path));
+    }
+
+    else if (values[PLAYLIST_ID][0] != '\0') {
+        search_result->media_type = PLAYLIST;
+        strncpy(search_result->id, values[PLAYLIST_ID], sizeof(search_result->id) - 1);
+        strncpy(search_result->title, values[PLAYLIST_TITLE], sizeof(search_result->title));
+
+        const char *thumbnail_path = strstr(values[PLAYLIST_THUMBNAIL], "/vi");
+        if (thumbnail_path) strncpy(search_result->thumbnail_path, thumbnail_path, sizeof(search_result->thumbnail_path));
+        strncpy(search_result->video_count, values[PLAYLIST_VIDEO_COUNT], sizeof(search_result->video_count));
+    }
+}
+
 #define MAX_THREADS 4
 
-typedef struct 
+// a thumbnail fetch in progress, search results of the same search that show the same image wait for it instead of fetching it again
+typedef struct ThumbnailFlight
+{
+    char host[256];
+    char path[256];
+    CancelToken cancel;
+    ThumbnailWaiter *waiters;
+    ThumbnailQueue *thumbnail_queue;
+    struct ThumbnailFlight *next;
+} ThumbnailFlight;
+
+// thread-safe, joined by the search threads and left by the http engine
+typedef struct
+{
+    ThumbnailFlight *head;
+    size_t fetches;         // thumbnails fetched over the network
+    size_t shared;          // thumbnails that waited for a fetch of another search result
+    pthread_mutex_t mutex;
+} ThumbnailFlights;
+
+static ThumbnailFlights thumbnail_flights;
+
+ThumbnailFlights init_thumbnail_flights()
+{
+    ThumbnailFlights flights;
+    flights.head = NULL;
+    flights.fetches = 0;
+    flights.shared = 0;
+    pthread_mutex_init(&flights.mutex, NULL);
+    return flights;
+}
+
+// expects every fetch to be finished (see stop_http_engine)
+void free_thumbnail_flights(ThumbnailFlights *flights)
+{
+    while (flights->head) {
+        ThumbnailFlight *to_free = flights->head;
+        flights->head = to_free->next;
+        free_thumbnail_waiters(to_free->waiters);
+        free(to_free);
+    }
+
+    pthread_mutex_destroy(&flights->mutex);
+}
+
+void print_thumbnail_flight_stats(ThumbnailFlights *flights)
 {
-    char search_result_id[64];
-    HTTP_Request http_request;
-    ThumbnailQueue *thumbnail_queue;
-} LoadThumbnailThreadArgs;
+    const size_t total = flights->fetches + flights->shared;
+    printf("thumbnails: %zu fetched, %zu shared a fetch (%.1f%% saved)\n", flights->fetches, flights->shared, total ? (100.0 * flights->shared / total) : 0.0);
+}
 
-void* load_thumbnail(void *args)
+// called by the http engine with the image data of a thumbnail, handed to every search result waiting for it
+void on_thumbnail_loaded(Buffer thumbnail_buffer, void *args)
 {
-    LoadThumbnailThreadArgs *targs = (LoadThumbnailThreadArgs*) args;
+    ThumbnailFlight *flight = (ThumbnailFlight*) args;
+
+    // results that ask for the image from now on start a new fetch
+    pthread_mutex_lock(&thumbnail_flights.mutex);
+        ThumbnailFlight **link = &thumbnail_flights.head;
+        while (*link && (*link != flight)) link = &(*link)->next;
+        if (*link) *link = flight->next;
+    pthread_mutex_unlock(&thumbnail_flights.mutex);
     
-    Buffer thumbnail_buffer = send_https_request(targs->http_request);
     if (!buffer_ready(&thumbnail_buffer)) {
-        printf("load_thumbnail: send_http_request returned invalid buffer\n");
-        free(targs);
-        return NULL;
+        printf("on_thumbnail_loaded: thumbnail of %s could not be fetched\n", flight->waiters->search_result_id);
+        free_thumbnail_waiters(flight->waiters);
+        free(flight);
+        return;
+    }
+
+    // the search results belong to an older search
+    if (token_cancelled(flight->cancel)) {
+        free_buffer(&thumbnail_buffer);
+        free_thumbnail_waiters(flight->waiters);
+        free(flight);
+        return;
     }
 
     // create thumbnail data node
     ThumbnailData *thumbnail_data = malloc(sizeof(ThumbnailData));
     if (!thumbnail_data) {
-        printf("load_thumbnail: malloc returned NULL for thumbnail_data\n");
-        free(targs);
-        return NULL;
+        printf("on_thumbnail_loaded: malloc returned NULL for thumbnail_data\n");
+        free_buffer(&thumbnail_buffer);
+        free_thumbnail_waiters(flight->waiters);
+        free(flight);
+        return;
     }
 
     thumbnail_data->image_data = thumbnail_buffer;
-    strcpy(thumbnail_data->search_result_id, targs->search_result_id);
+    thumbnail_data->waiters = flight->waiters;
 
     // add node to queue
-    pthread_mutex_lock(&targs->thumbnail_queue->mutex);
-    enqueue_thumbnail(targs->thumbnail_queue, thumbnail_data);
-    pthread_mutex_unlock(&targs->thumbnail_queue->mutex);
+    pthread_mutex_lock(&flight->thumbnail_queue->mutex);
+    enqueue_thumbnail(flight->thumbnail_queue, thumbnail_data);
+    pthread_mutex_unlock(&flight->thumbnail_queue->mutex);
 
-    free(targs);
-    return NULL;
+    free(flight);
+}
+
+// requests the thumbnail of a search result, the image data arrives in 'thumbnail_queue' unless 'cancel' is cancelled first
+// a result whose image is already being fetched for the same search waits for that fetch
+void load_thumbnail(const SearchResult *search_result, ThumbnailQueue *thumbnail_queue, const CancelToken cancel)
+{
+    ThumbnailWaiter *waiter = malloc(sizeof(ThumbnailWaiter));
+    ThumbnailFlight *new_flight = malloc(sizeof(ThumbnailFlight));
+    if (!waiter || !new_flight) {
+        printf("load_thumbnail: malloc returned NULL for waiter or flight\n");
+        free(waiter);
+        free(new_flight);
+        return;
+    }
+
+    strcpy(waiter->search_result_id, search_result->id);
+    waiter->next = NULL;
+
+    char *host = media_type_to_host(search_result->media_type);
+    snprintf(new_flight->host, sizeof(new_flight->host), "%s", host);
+    snprintf(new_flight->path, sizeof(new_flight->path), "%s", search_result->thumbnail_path);
+    new_flight->cancel = cancel;
+    new_flight->waiters = waiter;
+    new_flight->thumbnail_queue = thumbnail_queue;
+
+    pthread_mutex_lock(&thumbnail_flights.mutex);
+        ThumbnailFlight *flight = thumbnail_flights.head;
+        while (flight && ((flight->cancel.issued != cancel.issued) || (strcmp(flight->path, new_flight->path) != 0) || (strcmp(flight->host, host) != 0))) {
+            flight = flight->next;
+        }
+
+        if (flight) {
+            waiter->next = flight->waiters;
+            flight->waiters = waiter;
+            thumbnail_flights.shared++;
+        }
+        else {
+            new_flight->next = thumbnail_flights.head;
+            thumbnail_flights.head = new_flight;
+            thumbnail_flights.fetches++;
+        }
+    pthread_mutex_unlock(&thumbnail_flights.mutex);
+
+    if (flight) {
+        free(new_flight);
+        return;
+    }
+
+    HTTP_Request http_req = {0};
+    http_req.port = "443";
+    http_req.host = host;
+    http_req.allow_http2 = true;
+    http_req.allow_pipelining = true;
+    http_req.limited = true;
+    http_req.cacheable = true;
+    http_req.cancel = cancel;
+    strcpy(http_req.path, search_result->thumbnail_path);
+    configure_get_header(sizeof(http_req.header), http_req.header, http_req.host, http_req.path);
+
+    submit_https_request(&http_engine, &http_req, on_thumbnail_loaded, new_flight);
 }
 
 static char next_page_token[1024] = {0};
-void extract_continuation_token(const cJSON *continuationItemRenderer)
+void extract_continuation_token(const cJSON *continuationItemRenderer, const size_t n, char token[n])
 {
     cJSON *continuationEndpoint = continuationItemRenderer ? cJSON_GetObjectItem(continuationItemRenderer, "continuationEndpoint") : NULL;
     cJSON *continuationCommand = continuationEndpoint ? cJSON_GetObjectItem(continuationEndpoint, "continuationCommand") : NULL;
-    cJSON *token = continuationCommand ? cJSON_GetObjectItem(continuationCommand, "token") : NULL;
-    if (token && cJSON_IsString(token)) 
-        strncpy(next_page_token, token->valuestring, sizeof(next_page_token) - 1);
-
-    else {
-        printf("extract_continuation_token: token not found\n");
-        memset(next_page_token, 0, sizeof(next_page_token));
-    }
+    cJSON *token_item = continuationCommand ? cJSON_GetObjectItem(continuationCommand, "token") : NULL;
+    if (token_item && cJSON_IsString(token_item)) 
+        strncpy(token, token_item->valuestring, n - 1);
 }
 
 typedef struct ThreadTask
@@ -1322,6 +6250,7 @@ void* worker_thread_funct(void* args)
         free(task);
     }
 
+    free_scratch_buffer();
     return NULL;
 }
 
@@ -1348,62 +6277,54 @@ typedef struct
 {
     bool allow_youtube_shorts;
     SearchType search_type;
+    bool from_api;              // a NEW search that was posted to the api, its response is json rather than the results page
     HTTP_Request http_request;
     Results *search_results;
     ThumbnailQueue *thumbnail_queue;
 } SearchThreadArgs;
 
+// when true, the first page of a search is posted to the youtubei api and comes back as json,
+// rather than scanned out of the html of the results page
+static bool youtubei_search = false;
+
 #define MAX_SEARCH_ITEMS 100
 
 static int elements_added = 0; 
 static bool delete_old_nodes = false;
-static bool search_finished = true;
-void* get_results_from_query(void* args)
+static bool search_finished = true; // the search worker let go of the results, read and written with __atomic (see end_search)
+
+// every way out of 'get_results_from_query' ends here, the main thread starts the next search only after this
+void* end_search(SearchThreadArgs *targs)
 {
-    SearchThreadArgs* targs = (SearchThreadArgs*)args;
-    elements_added = 0;
-    clock_t start_time = clock(); 
+    free(targs);
+    __atomic_store_n(&search_finished, true, __ATOMIC_RELEASE);
+    return NULL;
+}
 
-    // get the information of the http request
-    Buffer http = send_https_request(targs->http_request);
-    bool application_is_offline = (buffer_ready(&http) == false);
-    if (application_is_offline) {
-        printf("get_results_from_query: send_https_request returned invalid buffer\n");
-        SetWindowTitle("[offline] - metube");
-        free(targs);
-        search_finished = true;
-        return NULL;
-    }
-    
-    // only keep data that is found in the json object 'sectionListRenderer'
-    if (targs->search_type == NEW) {
-        if (parse_json_object(&http, "sectionListRenderer", '{', '}') < 0) {
-            printf("get_results_from_query: parse_json_object corrupted data of passed buffer\n");
-            free_buffer(&http);
-            free(targs);
-            search_finished = true;
-            return NULL;
+// the items and the next page token out of a full cJSON tree of the response, the way results were parsed before the path tables.
+// the tree is built in the current arena and never deleted, it goes with the arena
+int add_results_from_json_dom(SearchThreadArgs *targs, const Buffer *http, const size_t n, char token[n])
+{
+    const CancelToken cancel = targs->http_request.cancel;
+
+    // the api answers with json that holds 'sectionListRenderer' at a known path, no need to search for it
+    cJSON* sectionListRenderer = NULL;
+    if (targs->from_api) {
+        cJSON *response = cJSON_Parse(http->data);
+        if (!response) {
+            printf("add_results_from_json_dom: cJSON_Parse returned NULL for the api response\n");
+            return -1;
         }
-    }
 
-    else if (targs->search_type == APPENDING) {
-        if (parse_json_object(&http, "continuationItems", '[', ']') < 0) {
-            printf("get_results_from_query: parse_json_object corrupted data of passed buffer\n");
-            free_buffer(&http);
-            free(targs);
-            search_finished = true;
-            return NULL;
-        }
+        cJSON *twoColumnSearchResultsRenderer = cJSON_GetObjectItem(cJSON_GetObjectItem(response, "contents"), "twoColumnSearchResultsRenderer");
+        cJSON *primaryContents = cJSON_GetObjectItem(twoColumnSearchResultsRenderer, "primaryContents");
+        sectionListRenderer = cJSON_GetObjectItem(primaryContents, "sectionListRenderer");
     }
+    else sectionListRenderer = cJSON_Parse(http->data);
 
-    // get json obj
-    cJSON* sectionListRenderer = cJSON_Parse(http.data);
     if (!sectionListRenderer) {
-        printf("get_results_from_query: cJSON_Parse returned NULL\n");
-        free_buffer(&http);
-        free(targs);
-        search_finished = true;
-        return NULL;
+        printf("add_results_from_json_dom: cJSON_Parse returned NULL\n");
+        return -1;
     }
 
     cJSON *sectionListRendererContents = NULL;
@@ -1425,46 +6346,19 @@ void* get_results_from_query(void* args)
         // loop through every item and get the node equivalent 
         cJSON *item;
         cJSON_ArrayForEach (item, contents) {
+            if (token_cancelled(cancel)) break;
             if ((targs->search_results->count < MAX_SEARCH_ITEMS) || (targs->search_type == NEW)) {
                 SearchResult *search_result = (SearchResult*) malloc(sizeof(SearchResult));
                 if (!search_result) {
-                    printf("get_results_from_query: malloc returned NULL for search_result\n");
-                    cJSON_Delete(sectionListRenderer);
-                    free_buffer(&http);
-                    free(targs);
-                    search_finished = true;
-                    return NULL;
+                    printf("add_results_from_json_dom: malloc returned NULL for search_result\n");
+                    return -1;
                 }
 
                 create_search_node_from_json(search_result, item, targs->allow_youtube_shorts);
                 if (search_result->media_type != UNDF) {
                     add_search_result(targs->search_results, search_result);
                     elements_added++;
-                    LoadThumbnailThreadArgs *thumbnailargs = malloc(sizeof(LoadThumbnailThreadArgs));
-                    if (thumbnailargs) {
-                        HTTP_Request http_req = {0};
-                        http_req.port = "443";
-                        http_req.host = media_type_to_host(search_result->media_type);
-                        strcpy(http_req.path, search_result->thumbnail_path);
-                        configure_get_header(sizeof(http_req.header), http_req.header, http_req.host, http_req.path);
-
-                        // configure the thread arguements to load thumbnail
-                        thumbnailargs->http_request = http_req;
-                        strcpy(thumbnailargs->search_result_id, search_result->id);
-                        thumbnailargs->thumbnail_queue = targs->thumbnail_queue;
-
-                        ThreadTask *async_thumbnail_load = malloc(sizeof(ThreadTask));
-                        (*async_thumbnail_load) = (ThreadTask) {
-                            .next = NULL,
-                            .args = thumbnailargs,
-                            .funct = load_thumbnail,
-                        };
-
-                        pthread_mutex_lock(&task_queue.mutex);
-                            enqueue_task(async_thumbnail_load, &task_queue);
-                            pthread_cond_signal(&task_queue.cond);
-                        pthread_mutex_unlock(&task_queue.mutex);
-                    }
+                    load_thumbnail(search_result, targs->thumbnail_queue, cancel);
                 }
                 else 
                     free_search_result(search_result);
@@ -1476,33 +6370,394 @@ void* get_results_from_query(void* args)
     if (targs->search_type == NEW) {
         cJSON *secondsectionListRendererObject = cJSON_GetArrayItem(sectionListRendererContents, 1);
         cJSON *continuationItemRenderer = secondsectionListRendererObject ? cJSON_GetObjectItem(secondsectionListRendererObject, "continuationItemRenderer") :NULL;
-        extract_continuation_token(continuationItemRenderer);
+        extract_continuation_token(continuationItemRenderer, n, token);
     }
 
     else if (targs->search_type == APPENDING) {
         cJSON *second_parent_item = cJSON_GetArrayItem(sectionListRenderer, 1);
         cJSON *continuationItemRenderer = second_parent_item ? cJSON_GetObjectItem(second_parent_item, "continuationItemRenderer") : NULL;
-        extract_continuation_token(continuationItemRenderer);
+        extract_continuation_token(continuationItemRenderer, n, token);
+    }
+
+    return 0;
+}
+
+// the layouts the results come in
+typedef enum
+{
+    RESULTS_PAGE,           // the 'sectionListRenderer' object of the html results page
+    CONTINUATION_PAGE,      // the 'continuationItems' array of a next page
+    API_RESPONSE,           // the whole response of a search posted to the api
+    N_PAGE_LAYOUTS
+} PageLayout;
+
+typedef enum
+{
+    PAGE_ITEMS,
+    PAGE_CONTINUATION_TOKEN,
+    N_PAGE_FIELDS
+} PageField;
+
+// where the items of 'contents' and the next page token are in each layout
+static const char *const search_page_paths[N_PAGE_LAYOUTS][N_PAGE_FIELDS] = {
+    [RESULTS_PAGE] = {
+        [PAGE_ITEMS] = "contents[0].itemSectionRenderer.contents[*]",
+        [PAGE_CONTINUATION_TOKEN] = "contents[1].continuationItemRenderer.continuationEndpoint.continuationCommand.token",
+    },
+    [CONTINUATION_PAGE] = {
+        [PAGE_ITEMS] = "[0].itemSectionRenderer.contents[*]",
+        [PAGE_CONTINUATION_TOKEN] = "[1].continuationItemRenderer.continuationEndpoint.continuationCommand.token",
+    },
+    [API_RESPONSE] = {
+        [PAGE_ITEMS] = "contents.twoColumnSearchResultsRenderer.primaryContents.sectionListRenderer.contents[0].itemSectionRenderer.contents[*]",
+        [PAGE_CONTINUATION_TOKEN] = "contents.twoColumnSearchResultsRenderer.primaryContents.sectionListRenderer"
+                                    ".contents[1].continuationItemRenderer.continuationEndpoint.continuationCommand.token",
+    },
+};
+
+static JsonSchema item_schema;
+static JsonSchema search_page_schemas[N_PAGE_LAYOUTS];
+static pthread_once_t search_schemas_compiled = PTHREAD_ONCE_INIT;
+
+void compile_search_schemas()
+{
+    compile_json_schema(&item_schema, item_field_paths, N_ITEM_FIELDS);
+    for (int layout = 0; layout < N_PAGE_LAYOUTS; layout++) {
+        compile_json_schema(&search_page_schemas[layout], search_page_paths[layout], N_PAGE_FIELDS);
+    }
+}
+
+// where an item of 'contents' is in the page
+typedef struct
+{
+    size_t start;
+    size_t len;
+} JsonSpan;
+
+// what a walk over a page of results collects, the items are only stepped over and parsed afterwards
+typedef struct
+{
+    SearchThreadArgs *targs;
+    char *token;
+    size_t token_size;
+    JsonSpan *items;
+    int nitems;
+    int capacity;
+} SearchPage;
+
+int on_search_page_value(JsonCursor *cursor, const int field, void *user_data)
+{
+    SearchPage *page = (SearchPage*) user_data;
+
+    if (field == PAGE_CONTINUATION_TOKEN) {
+        if (peek_json_char(cursor) != '"') return 0;
+        return read_json_string(cursor, page->token, page->token_size);
+    }
+
+    // an item of 'contents'
+    if (token_cancelled(page->targs->http_request.cancel)) return 0;
+    if (page->nitems == page->capacity) {
+        const int capacity = page->capacity ? (2 * page->capacity) : 32;
+        JsonSpan *items = (JsonSpan*) realloc(page->items, capacity * sizeof(JsonSpan));
+        if (!items) {
+            printf("on_search_page_value: realloc returned NULL for %d items\n", capacity);
+            return -1;
+        }
+        page->items = items;
+        page->capacity = capacity;
+    }
+
+    peek_json_char(cursor);
+    const size_t start = cursor->pos;
+    if (skip_json_value(cursor) < 0) return -1;
+    page->items[page->nitems++] = (JsonSpan){start, cursor->pos - start};
+    return 0;
+}
+
+#define ITEMS_PER_CHUNK 8
+
+// the items of a page, parsed a chunk at a time by the search thread and whichever workers of the pool are idle to help it
+typedef struct
+{
+    const char *data;
+    const JsonSpan *items;
+    SearchResult **results;         // in the order of the items, NULL for those that aren't search results
+    int nitems;
+    bool allow_shorts;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t chunk_done;
+    int nchunks;
+    int next_chunk;
+    int chunks_done;
+    int chunks_helped;              // parsed by other workers
+    int references;                 // the search thread and every helper task, the last one to let go frees the batch
+} ItemBatch;
+
+SearchResult* create_search_node_from_span(const char *data, const JsonSpan span, const bool allow_shorts)
+{
+    ItemFields fields = {0};
+    JsonCursor cursor = {&data[span.start], span.len, 0};
+    if (walk_json(&cursor, &item_schema, on_item_field, &fields) < 0) return NULL;
+
+    SearchResult *search_result = (SearchResult*) malloc(sizeof(SearchResult));
+    if (!search_result) {
+        printf("create_search_node_from_span: malloc returned NULL for search_result\n");
+        return NULL;
+    }
+
+    create_search_node_from_fields(search_result, &fields, allow_shorts);
+    if (search_result->media_type == UNDF) {
+        free_search_result(search_result);
+        return NULL;
+    }
+    return search_result;
+}
+
+// claims and parses the next chunk nobody took yet, false once there is none. 
+// the page is only read for a claimed chunk, the search thread waits for those before it lets go of the page
+bool parse_next_item_chunk(ItemBatch *batch, const bool helping)
+{
+    pthread_mutex_lock(&batch->mutex);
+        const int chunk = batch->next_chunk;
+        if (chunk < batch->nchunks) batch->next_chunk++;
+    pthread_mutex_unlock(&batch->mutex);
+    if (chunk >= batch->nchunks) return false;
+
+    const int first = chunk * ITEMS_PER_CHUNK;
+    const int last = (first + ITEMS_PER_CHUNK < batch->nitems) ? (first + ITEMS_PER_CHUNK) : batch->nitems;
+    for (int i = first; i < last; i++) {
+        batch->results[i] = create_search_node_from_span(batch->data, batch->items[i], batch->allow_shorts);
+    }
+
+    pthread_mutex_lock(&batch->mutex);
+        batch->chunks_done++;
+        batch->chunks_helped += helping;
+        pthread_cond_signal(&batch->chunk_done);
+    pthread_mutex_unlock(&batch->mutex);
+    return true;
+}
+
+void release_item_batch(ItemBatch *batch)
+{
+    pthread_mutex_lock(&batch->mutex);
+        const bool last = (--batch->references == 0);
+    pthread_mutex_unlock(&batch->mutex);
+    if (!last) return;
+
+    // results that were never merged (a cancelled search) go with the batch
+    for (int i = 0; i < batch->nitems; i++) free_search_result(batch->results[i]);
+    free(batch->results);
+    pthread_mutex_destroy(&batch->mutex);
+    pthread_cond_destroy(&batch->chunk_done);
+    free(batch);
+}
+
+// a task of the pool, by the time it runs the search thread may have parsed every chunk already
+void* help_parse_items(void *args)
+{
+    ItemBatch *batch = (ItemBatch*) args;
+    while (parse_next_item_chunk(batch, true));
+    release_item_batch(batch);
+    return NULL;
+}
+
+// helpers still queued at shutdown never run, the references they hold would keep their batches alive
+void release_queued_item_batches(TaskQueue *queue)
+{
+    pthread_mutex_lock(&queue->mutex);
+        ThreadTask *task = queue->head;
+        for (size_t i = 0; (i < queue->count) && task; i++, task = task->next) {
+            if (task->funct == help_parse_items) release_item_batch((ItemBatch*) task->args);
+        }
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+// splits the items into chunks that the search thread parses along with the idle workers of the pool
+ItemBatch* parse_items_in_parallel(const char *data, const JsonSpan *items, const int nitems, const bool allow_shorts)
+{
+    ItemBatch *batch = (ItemBatch*) calloc(1, sizeof(ItemBatch));
+    SearchResult **results = (SearchResult**) calloc(nitems ? nitems : 1, sizeof(SearchResult*));
+    if (!batch || !results) {
+        printf("parse_items_in_parallel: calloc returned NULL for %d items\n", nitems);
+        free(batch);
+        free(results);
+        return NULL;
+    }
+
+    batch->data = data;
+    batch->items = items;
+    batch->results = results;
+    batch->nitems = nitems;
+    batch->allow_shorts = allow_shorts;
+    batch->nchunks = (nitems + ITEMS_PER_CHUNK - 1) / ITEMS_PER_CHUNK;
+    batch->references = 1;
+    pthread_mutex_init(&batch->mutex, NULL);
+    pthread_cond_init(&batch->chunk_done, NULL);
+
+    // one chunk is left for this thread, the rest can go to as many other workers as there are
+    const int helpers = ((batch->nchunks - 1) < (MAX_THREADS - 1)) ? (batch->nchunks - 1) : (MAX_THREADS - 1);
+    for (int i = 0; i < helpers; i++) {
+        ThreadTask *task = malloc(sizeof(ThreadTask));
+        if (!task) {
+            printf("parse_items_in_parallel: malloc returned NULL for ThreadTask object\n");
+            break;
+        }
+        (*task) = (ThreadTask) {
+            .next = NULL,
+            .args = batch,
+            .funct = help_parse_items,
+        };
+
+        batch->references++;
+        pthread_mutex_lock(&task_queue.mutex);
+            enqueue_task(task, &task_queue);
+            pthread_cond_signal(&task_queue.cond);
+        pthread_mutex_unlock(&task_queue.mutex);
+    }
+
+    while (parse_next_item_chunk(batch, false));
+
+    // only chunks that a helper is in the middle of are waited for
+    pthread_mutex_lock(&batch->mutex);
+        while (batch->chunks_done < batch->nchunks) pthread_cond_wait(&batch->chunk_done, &batch->mutex);
+    pthread_mutex_unlock(&batch->mutex);
+
+    return batch;
+}
+
+// the items and the next page token pulled out by the static path tables, no tree is built. one pass over the page finds
+// where the items are, then they are parsed in parallel and added in the order of the page
+int add_results_from_json_paths(SearchThreadArgs *targs, const Buffer *http, const size_t n, char token[n])
+{
+    pthread_once(&search_schemas_compiled, compile_search_schemas);
+
+    const PageLayout layout = targs->from_api ? API_RESPONSE : ((targs->search_type == NEW) ? RESULTS_PAGE : CONTINUATION_PAGE);
+    SearchPage page = {targs, token, n, NULL, 0, 0};
+    JsonCursor cursor = {http->data, http->size, 0};
+    if (walk_json(&cursor, &search_page_schemas[layout], on_search_page_value, &page) < 0) {
+        // the items found before the json broke off are still good
+        printf("add_results_from_json_paths: the results are cut short after %d items\n", page.nitems);
+        if (page.nitems == 0) {
+            free(page.items);
+            return -1;
+        }
+    }
+
+    ItemBatch *batch = parse_items_in_parallel(http->data, page.items, page.nitems, targs->allow_youtube_shorts);
+    if (!batch) {
+        free(page.items);
+        return -1;
+    }
+
+    for (int i = 0; (i < batch->nitems) && !token_cancelled(targs->http_request.cancel); i++) {
+        SearchResult *search_result = batch->results[i];
+        if (!search_result) continue;
+        if ((targs->search_results->count >= MAX_SEARCH_ITEMS) && (targs->search_type != NEW)) break;
+
+        batch->results[i] = NULL;
+        add_search_result(targs->search_results, search_result);
+        elements_added++;
+        load_thumbnail(search_result, targs->thumbnail_queue, targs->http_request.cancel);
+    }
+
+    printf("add_results_from_json_paths: %d items in %d chunks, %d of those chunks parsed by other workers\n", batch->nitems, batch->nchunks, batch->chunks_helped);
+    release_item_batch(batch);
+    free(page.items);
+    return 0;
+}
+
+// parse the results into a full cJSON tree rather than pulling them out by path, to compare the two
+static bool json_dom = false;
+
+void* get_results_from_query(void* args)
+{
+    SearchThreadArgs* targs = (SearchThreadArgs*)args;
+    const CancelToken cancel = targs->http_request.cancel;
+    
+    // a newer search was started while this one was queued
+    if (token_cancelled(cancel)) {
+        return end_search(targs);
+    }
+
+    elements_added = 0;
+    const double start_time = get_monotonic_time();
+
+    // get the information of the http request
+    RequestTimings timings = {0};
+    targs->http_request.timings = &timings;
+    Buffer http = send_https_request(targs->http_request);
+    print_request_phases("search request", &timings);
+    if (token_cancelled(cancel)) {
+        printf("get_results_from_query: search was cancelled\n");
+        return_scratch_buffer(&http);
+        return end_search(targs);
+    }
+
+    bool application_is_offline = (buffer_ready(&http) == false);
+    if (application_is_offline) {
+        printf("get_results_from_query: send_https_request returned invalid buffer\n");
+        // the engine already retried, an open circuit means the host is down rather than the search unlucky
+        SetWindowTitle(count_open_circuits(&http_engine) ? "[offline, degraded mode] - metube" : "[search failed] - metube");
+        return end_search(targs);
+    }
+    
+    // only keep data that is found in the json object 'sectionListRenderer', unless the engine already did while the page arrived.
+    // the api response is json as a whole, the paths into it are known
+    if ((targs->search_type == NEW) && !targs->from_api && !targs->http_request.extract_object) {
+        if (parse_json_object(&http, "sectionListRenderer", '{', '}') < 0) {
+            printf("get_results_from_query: parse_json_object corrupted data of passed buffer\n");
+            return_scratch_buffer(&http);
+            return end_search(targs);
+        }
+    }
+
+    else if ((targs->search_type == APPENDING) && !targs->http_request.extract_object) {
+        if (parse_json_object(&http, "continuationItems", '[', ']') < 0) {
+            printf("get_results_from_query: parse_json_object corrupted data of passed buffer\n");
+            return_scratch_buffer(&http);
+            return end_search(targs);
+        }
+    }
+
+    // whatever cJSON allocates for this search comes out of one arena that is dropped whole after the parse
+    Arena arena = init_arena();
+    current_arena = &arena;
+    char token[sizeof(next_page_token)] = {0};
+    const int parsed = json_dom ? add_results_from_json_dom(targs, &http, sizeof(token), token) : add_results_from_json_paths(targs, &http, sizeof(token), token);
+    current_arena = NULL;
+    const size_t json_bytes = arena.allocated;
+    const size_t json_blocks_bytes = arena.reserved;
+    free_arena(&arena);
+    return_scratch_buffer(&http);
+    if (parsed < 0) {
+        return end_search(targs);
     }
 
-    clock_t end_time = clock();
+    // a newer search waits for this one to end, and replaces these results
+    if (token_cancelled(cancel)) {
+        printf("get_results_from_query: search was cancelled\n");
+        return end_search(targs);
+    }
+
+    // the next page token    
+    if (token[0] == '\0') printf("get_results_from_query: next page token not found\n");
+    memcpy(next_page_token, token, sizeof(next_page_token));
+
+    const double end_time = get_monotonic_time();
 
     delete_old_nodes = targs->search_type == NEW;
-    search_finished = true;
 
+    // some host (the thumbnails' most likely) is down
+    const char *degraded = count_open_circuits(&http_engine) ? ", degraded" : "";
     if (targs->search_type == NEW)
-        SetWindowTitle(TextFormat("[search results(%d)] - metube", elements_added));
+        SetWindowTitle(TextFormat("[search results(%d)%s] - metube", elements_added, degraded));
     else if (targs->search_type == APPENDING)
-        SetWindowTitle(TextFormat("[search results(%d)] - metube", targs->search_results->count));
+        SetWindowTitle(TextFormat("[search results(%d)%s] - metube", targs->search_results->count, degraded));
     
-    printf("search took %f seconds, found %d items\n", ((end_time - start_time) / (CLOCKS_PER_SEC * 1.0f)) * 10, elements_added);
+    printf("search took %.3f seconds, found %d items, %zu bytes of json allocated (%zu reserved)\n", end_time - start_time, elements_added, json_bytes, json_blocks_bytes);
     
-    // deinit
-    cJSON_Delete(sectionListRenderer);
-    free_buffer(&http);
-    free(targs);
-
-    return NULL;
+    return end_search(targs);
 }
 
 void init_app()
@@ -1515,23 +6770,22 @@ void init_app()
     InitWindow(1000, 750, "metube");
 }
 
-Texture load_thumbnail_from_memory(const Buffer buffer, const float width, const float height)
+// decodes and resizes a thumbnail, the image can be turned into any number of textures
+Image load_thumbnail_image(const Buffer buffer, const float width, const float height)
 {
     if (buffer_ready(&buffer)) {
         Image image = LoadImageFromMemory(".jpeg", (unsigned char*) buffer.data, buffer.size);
         if (IsImageReady(image)) {
             ImageResize(&image, width, height);
-            Texture2D ret = LoadTextureFromImage(image);
-            UnloadImage(image);
-            return ret;
+            return image;
         }
         else 
-            printf("load_thumbnail_from_memory: failed to load image data\n");
+            printf("load_thumbnail_image: failed to load image data\n");
     }
     else
-        printf("load_thumbnail_from_memory: buffer arg is invalid\n");
+        printf("load_thumbnail_image: buffer arg is invalid\n");
     
-    return (Texture){0};
+    return (Image){0};
 }
 
 typedef struct
@@ -1751,28 +7005,156 @@ void draw_filter_window(Query *query, const Rectangle container, const Font font
     }
 }
 
+// connects to the search host and the thumbnail hosts ahead of the first search
+void warm_up_search_connections()
+{
+    warm_up_connection(&http_engine, media_type_to_host(ANY), "443", false);
+    warm_up_connection(&http_engine, media_type_to_host(VIDEO), "443", true);
+    warm_up_connection(&http_engine, media_type_to_host(CHANNEL), "443", true);
+}
+
+#define BENCHMARK_FETCHES 100
+#define BENCHMARK_THUMBNAIL_PATH "/vi/dQw4w9WgXcQ/hqdefault.jpg"
+
+typedef struct
+{
+    size_t done;
+    size_t failed;
+    size_t bytes;
+    double started_at;
+    double latencies[BENCHMARK_FETCHES];
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} ThumbnailBenchmark;
+
+void on_benchmark_thumbnail_loaded(Buffer response, void *user_data)
+{
+    ThumbnailBenchmark *benchmark = (ThumbnailBenchmark*) user_data;
+    
+    pthread_mutex_lock(&benchmark->mutex);
+        benchmark->latencies[benchmark->done++] = get_monotonic_time() - benchmark->started_at;
+        benchmark->bytes += response.size;
+        if (response.size == 0) benchmark->failed++;
+        pthread_cond_signal(&benchmark->cond);
+    pthread_mutex_unlock(&benchmark->mutex);
+
+    free_buffer(&response);
+}
+
+// fetches a thumbnail BENCHMARK_FETCHES times at once, the way a page of results does, 
+// to compare the network backends (see io_uring_backend)
+void run_thumbnail_benchmark()
+{
+    ThumbnailBenchmark benchmark;
+    benchmark.done = benchmark.failed = benchmark.bytes = 0;
+    pthread_mutex_init(&benchmark.mutex, NULL);
+    pthread_cond_init(&benchmark.cond, NULL);
+
+    // the same requests load_thumbnail sends, without the cache that would answer all but the first
+    HTTP_Request http_req = {0};
+    http_req.port = "443";
+    http_req.host = media_type_to_host(VIDEO);
+    http_req.allow_http2 = true;
+    http_req.allow_pipelining = true;
+    http_req.limited = true;
+    strcpy(http_req.path, BENCHMARK_THUMBNAIL_PATH);
+    configure_get_header(sizeof(http_req.header), http_req.header, http_req.host, http_req.path);
+
+    benchmark.started_at = get_monotonic_time();
+    for (size_t i = 0; i < BENCHMARK_FETCHES; i++) {
+        submit_https_request(&http_engine, &http_req, on_benchmark_thumbnail_loaded, &benchmark);
+    }
+
+    pthread_mutex_lock(&benchmark.mutex);
+        while (benchmark.done < BENCHMARK_FETCHES) {
+            pthread_cond_wait(&benchmark.cond, &benchmark.mutex);
+        }
+    pthread_mutex_unlock(&benchmark.mutex);
+
+    // callbacks finish in order of completion, so the latencies are sorted already
+    const double elapsed = get_monotonic_time() - benchmark.started_at;
+    printf("thumbnail benchmark (%s): %d fetches, %zu failed, %.1f KB in %.1f ms, p50 %.1f ms, p90 %.1f ms, max %.1f ms\n", 
+            http_engine.uring ? "io_uring" : "epoll", BENCHMARK_FETCHES, benchmark.failed, benchmark.bytes / 1024.0, elapsed * 1000,
+            benchmark.latencies[BENCHMARK_FETCHES / 2] * 1000, benchmark.latencies[(BENCHMARK_FETCHES * 9) / 10] * 1000, benchmark.latencies[BENCHMARK_FETCHES - 1] * 1000);
+
+    pthread_mutex_destroy(&benchmark.mutex);
+    pthread_cond_destroy(&benchmark.cond);
+}
+
+#define JSON_BENCHMARK_SECONDS 1.0
+
+// times the scan for the end of the results object of a recorded page byte by byte and in blocks, both have to agree on it
+int run_json_scan_benchmark(const char *filename)
+{
+    Buffer page = load_file_into_memory(filename);
+    if (!buffer_ready(&page)) return 1;
+
+    char *object_position = strstr(page.data, "sectionListRenderer");
+    char *start = object_position ? strchr(object_position, '{') : NULL;
+    if (!start) {
+        printf("run_json_scan_benchmark: \"%s\" has no sectionListRenderer\n", filename);
+        free_buffer(&page);
+        return 1;
+    }
+
+    const size_t n = page.size - (start - page.data);
+    size_t ends[2];
+    for (int blocks = 0; blocks < 2; blocks++) {
+        size_t runs = 0;
+        double elapsed = 0;
+        const double started_at = get_monotonic_time();
+        while (elapsed < JSON_BENCHMARK_SECONDS) {
+            JsonScanState state = {0};
+            ends[blocks] = blocks ? scan_json_structure(&state, start, n, '{', '}') : scan_json_bytes(&state, start, n, '{', '}');
+            runs++;
+            elapsed = get_monotonic_time() - started_at;
+        }
+
+        const size_t scanned = (ends[blocks] < n) ? (ends[blocks] + 1) : n;
+#ifdef __SSE2__
+        const char *method = blocks ? "sse2 blocks" : "byte by byte";
+#else
+        const char *method = blocks ? "blocks (no sse2, byte by byte)" : "byte by byte";
+#endif
+        printf("json scan (%s): %zu of %zu bytes scanned %zu times, %.2f GB/s\n", method, scanned, page.size, runs, (scanned * (double) runs) / elapsed / 1e9);
+    }
+
+    free_buffer(&page);
+    if (ends[0] != ends[1]) {
+        printf("run_json_scan_benchmark: the scans disagree on the end of the object (%zu and %zu)\n", ends[0], ends[1]);
+        return 1;
+    }
+    return 0;
+}
+
 void process_async_loaded_thumbnails(ThumbnailQueue *thumbnail_queue, Results *results)
 {
     pthread_mutex_lock(&thumbnail_queue->mutex);
     while (thumbnail_queue->head) {
         ThumbnailData *thumbnail_data = dequeue_thumbnail(thumbnail_queue);
+        Image image = load_thumbnail_image(thumbnail_data->image_data, 160, 80);
         
-        // find matching search node and load texture
-        for (SearchResult *search_node = results->head; search_node; search_node = search_node->next) {
-            if (strcmp(thumbnail_data->search_result_id, search_node->id) == 0) {
-                // clear thumbnail
-                if (IsTextureReady(search_node->thumbnail))
-                    UnloadTexture(search_node->thumbnail);
-                
-                // add texture to cache
-                search_node->thumbnail = load_thumbnail_from_memory(thumbnail_data->image_data, 160, 80);
-                if (!IsTextureReady(search_node->thumbnail)) {
-                    printf("%s failed to load texture\n", search_node->id);
-                }
-                break;
+        // every search node of a waiting id gets its own texture of the image, repeated results share an id
+        for (SearchResult *search_node = results->head; search_node && IsImageReady(image); search_node = search_node->next) {
+            bool waiting = false;
+            for (ThumbnailWaiter *waiter = thumbnail_data->waiters; waiter && !waiting; waiter = waiter->next) {
+                waiting = (strcmp(waiter->search_result_id, search_node->id) == 0);
+            }
+            if (!waiting) continue;
+
+            // clear thumbnail
+            if (IsTextureReady(search_node->thumbnail))
+                UnloadTexture(search_node->thumbnail);
+            
+            // add texture to cache
+            search_node->thumbnail = LoadTextureFromImage(image);
+            if (!IsTextureReady(search_node->thumbnail)) {
+                printf("%s failed to load texture\n", search_node->id);
             }
         }
 
+        if (IsImageReady(image)) UnloadImage(image);
+
         // remove processed thumbnail data
         free_thumbnail_data(thumbnail_data);
     }
@@ -1780,10 +7162,66 @@ void process_async_loaded_thumbnails(ThumbnailQueue *thumbnail_queue, Results *r
 }
 
 
-int main()
+int main(int argc, char **argv)
 {
+    // before any thread can parse, the hooks are global
+    cJSON_InitHooks(&(cJSON_Hooks){cjson_alloc, cjson_free});
+
+    bool benchmark_thumbnails = false;
+    const char *benchmark_json = NULL;
+    for (int i = 1; i < argc; i++) {
+        // connect to one address at a time, to compare connect times against racing them
+        if (strcmp(argv[i], "--no-happy-eyeballs") == 0) happy_eyeballs = false;
+        // let the kernel decrypt connections whose cipher it supports
+        else if (strcmp(argv[i], "--kernel-tls") == 0) kernel_tls = true;
+        // submit connects, sends and receives to an io_uring rather than waiting on epoll
+        else if (strcmp(argv[i], "--io-uring") == 0) io_uring_backend = true;
+        // time a burst of thumbnail fetches with the selected backend, then exit
+        else if (strcmp(argv[i], "--benchmark-thumbnails") == 0) benchmark_thumbnails = true;
+        // time the scan for the results object of a saved results page, then exit
+        else if ((strcmp(argv[i], "--benchmark-json") == 0) && (i + 1 < argc)) benchmark_json = argv[++i];
+        // get the first page of a search as json from the api rather than the html results page
+        else if (strcmp(argv[i], "--youtubei-search") == 0) youtubei_search = true;
+        // parse search results into a full cJSON tree, as before the path tables
+        else if (strcmp(argv[i], "--json-dom") == 0) json_dom = true;
+        else printf("main: unknown argument \"%s\"\n", argv[i]);
+    }
+
+    if (benchmark_json) {
+        return run_json_scan_benchmark(benchmark_json);
+    }
+
     Results results = init_results();
     ThumbnailQueue thumbnail_queue = init_thumbnail_queue();
+    thumbnail_flights = init_thumbnail_flights();
+    connection_pool = init_connection_pool();
+    tls_session_cache = init_tls_session_cache();
+    response_cache = init_response_cache();
+    dns_cache = init_dns_cache();
+    if (init_http_engine(&http_engine) != 0) {
+        printf("main: init_http_engine failed, metube will be offline\n");
+    }
+
+    if (benchmark_thumbnails) {
+        run_thumbnail_benchmark();
+        stop_http_engine(&http_engine);
+        print_connect_time_stats(&http_engine);
+        print_concurrency_limits(&http_engine);
+        print_retry_stats(&http_engine);
+        print_request_timings(&http_engine);
+        free_connection_pool(&connection_pool);
+        free_http_engine(&http_engine);
+        print_tls_session_stats(&tls_session_cache);
+        free_tls_session_cache(&tls_session_cache);
+        free_response_cache(&response_cache);
+        free_dns_cache(&dns_cache);
+        free_thumbnail_flights(&thumbnail_flights);
+        free_thumbnail_queue(&thumbnail_queue);
+        free_results(&results);
+        if (ctx) SSL_CTX_free(ctx);
+        return 0;
+    }
+    warm_up_search_connections();
     
     // TaskQueue task_queue = init_task_queue();
     task_queue = init_task_queue();
@@ -1792,6 +7230,7 @@ int main()
     
     // when true, the application starts the search process
     bool search = false;
+    bool previous_search_cancelled = false;
     char search_buffer[256] = {0};
 
     // the current_query that the user has constructed
@@ -1821,7 +7260,8 @@ int main()
     {
         process_async_loaded_thumbnails(&thumbnail_queue, &results);
 
-        if (delete_old_nodes) {
+        const bool search_ended = __atomic_load_n(&search_finished, __ATOMIC_ACQUIRE);
+        if (search_ended && delete_old_nodes) {
             scroll.y = 0;
             delete_old_nodes = false;
             int nodes_to_delete = results.count - elements_added;
@@ -1833,8 +7273,16 @@ int main()
             } 
         }
 
-        if (search) {
+        // everything still running for the previous search is obsolete, its worker is waited for rather than raced over the results
+        if (search && (search_type == NEW) && !previous_search_cancelled) {
+            cancel_generation(&search_generation);
+            expire_cancelled_http_requests(&http_engine);
+            previous_search_cancelled = true;
+        }
+
+        if (search && search_ended) {
             search = false;
+            previous_search_cancelled = false;
             search_finished = false;
             SearchThreadArgs *targs = malloc(sizeof(SearchThreadArgs));
             if (!targs) 
@@ -1846,8 +7294,25 @@ int main()
                 HTTP_Request http_request = {0};
                 http_request.host = "www.youtube.com";
                 http_request.port = "443";
+                http_request.cancel = current_search_token();
+
+                // the path of an api search is the same for every query, its response can't be cached by it.
+                // a query that doesn't fit into the post body is searched for on the results page instead
+                bool api_search = (search_type == NEW) && youtubei_search;
+                if (api_search && (configure_search_post_body(sizeof(http_request.body), http_request.body, search_buffer, query) < 0)) {
+                    printf("main: the query does not fit an api search, searching the results page\n");
+                    http_request.body[0] = '\0';
+                    api_search = false;
+                }
+
+                if (api_search) {
+                    strcpy(http_request.path, "/youtubei/v1/search");
+                    configure_post_header(sizeof(http_request.header), http_request.header, http_request.host, http_request.path, strlen(http_request.body));
+                }
 
-                if (search_type == NEW) {
+                else if (search_type == NEW) {
+                    http_request.cacheable = true;
+                    http_request.extract_object = "sectionListRenderer";
                     configure_youtube_search_query_path(sizeof(http_request.path), http_request.path, query);
                     configure_get_header(sizeof(http_request.header), http_request.header, http_request.host, http_request.path);
                 }
@@ -1855,10 +7320,12 @@ int main()
                 else if (search_type == APPENDING) {
                     strcpy(http_request.path, "/youtubei/v1/search");
                     configure_post_body(sizeof(http_request.body), http_request.body, next_page_token);
+                    http_request.extract_object = "continuationItems";
                     configure_post_header(sizeof(http_request.header), http_request.header, http_request.host, http_request.path, strlen(http_request.body));
                 }
 
                 targs->search_type = search_type;
+                targs->from_api = api_search;
                 targs->allow_youtube_shorts = query.allow_youtube_shorts;
                 targs->search_results = &results;
                 targs->thumbnail_queue = &thumbnail_queue;
@@ -1906,6 +7373,9 @@ int main()
             int text_box_status;
             if ((text_box_status = GuiTextBox(search_bar_bounds, search_buffer, sizeof(search_buffer), edit_mode))) {
                 edit_mode = !edit_mode;
+
+                // the user is about to search, connections that went idle since startup are replaced now
+                if (edit_mode) warm_up_search_connections();
             }
 
             bool enter_key_pressed = text_box_status == 2;
@@ -1927,7 +7397,7 @@ int main()
                     if (!query.encoded_query) 
                         printf("main: url_encode_string returned NULL\n");
                     else {
-                        search = search_finished;
+                        search = true;
                         search_type = NEW;
                     }
                 }
@@ -1978,9 +7448,9 @@ int main()
             const int SCROLLBAR_WIDTH = vertical_scrollbar_visible ? 13 : 0;
 
             bool scrollbar_out_of_bounds = GuiScrollPanel(scroll_window_bounds, NULL, content_area, &scroll, &scrollView);
-            if (scrollbar_out_of_bounds && query.encoded_query && query.encoded_query[0] != '\0' && next_page_token[0] != '\0') {
+            if (!search && scrollbar_out_of_bounds && query.encoded_query && query.encoded_query[0] != '\0' && next_page_token[0] != '\0') {
                 search_type = APPENDING;
-                search = search_finished && results.count < MAX_SEARCH_ITEMS;
+                search = __atomic_load_n(&search_finished, __ATOMIC_ACQUIRE) && results.count < MAX_SEARCH_ITEMS;
             }
 
             const Rectangle scissor_rect = padded_rectangle(1, scroll_window_bounds);
@@ -2055,21 +7525,36 @@ int main()
         EndDrawing();
     }
 
+    // stop the background work first, the engine fails whatever is in flight so no worker waits on it
+    stop_http_engine(&http_engine);
+    application_running = false;
+    pthread_cond_broadcast(&task_queue.cond);
+    free_thread_pool(MAX_THREADS, thread_pool);
+    release_queued_item_batches(&task_queue);
+    free_task_queue(&task_queue);         
+    print_connect_time_stats(&http_engine);
+    print_concurrency_limits(&http_engine);
+    print_retry_stats(&http_engine);
+    print_request_timings(&http_engine);
+    free_connection_pool(&connection_pool);
+    free_http_engine(&http_engine);
+
     // deinit app
     UnloadFont(ui.font);
     free_results(&results);
     free_thumbnail_queue(&thumbnail_queue);
+    print_thumbnail_flight_stats(&thumbnail_flights);
+    free_thumbnail_flights(&thumbnail_flights);
     if (query.encoded_query) free(query.encoded_query);
     
     // ssl stuff
+    print_tls_session_stats(&tls_session_cache);
+    free_tls_session_cache(&tls_session_cache);
+    print_response_cache_stats(&response_cache);
+    free_response_cache(&response_cache);
+    print_dns_cache_stats(&dns_cache);
+    free_dns_cache(&dns_cache);
     if (ctx) SSL_CTX_free(ctx);
-    if (addrinfo) freeaddrinfo(addrinfo);
-    
-    // free worker thread stuff
-    application_running = false;
-    pthread_cond_broadcast(&task_queue.cond);
-    free_thread_pool(MAX_THREADS, thread_pool);
-    free_task_queue(&task_queue);         
     
     CloseWindow();
     return 0;